@@ -13,6 +13,8 @@
 #include <sys/ioctl.h>
 #include <stdint.h>
 
+#include "i2c_bench.h"
+
 #define OV490_BANK_HIGH			0xfffd
 #define OV490_BANK_LOW			0xfffe
 //#define DEBUG_ON 1
@@ -20,6 +22,7 @@
 enum xfer_state {
 	READ = 0,
 	WRITE = 1,
+	BENCH = 2,
 	NOTSET = -1
 };
 
@@ -36,6 +39,7 @@ char filename[20] = { 0 };
 static struct option long_options[] = {
 	{"write", required_argument, 0, 'w'},
 	{"read", required_argument, 0, 'r'},
+	{"bench", required_argument, 0, 'b'},
 	{"help", no_argument, 0, 'h'},
 	{0, 0, 0, 0}
 };
@@ -43,7 +47,8 @@ static struct option long_options[] = {
 static void display_menu(void)
 {
 	printf("SCCB Tool\n");
-	printf("sccb -[w:r] <i2c_adapter> <i2c_addr> <reg_size>[w:s:b] <off> <val>\n\n");
+	printf("sccb -[w:r] <i2c_adapter> <i2c_addr> <reg_size>[w:s:b] <off> <val>\n");
+	printf("sccb -b <i2c_adapter> <i2c_addr> <reg_size>[s:b] <off> <count> <size> [r:w]\n\n");
 }
 
 /* read a register with 16bit address */
@@ -220,13 +225,19 @@ int main(int argc, char *argv[])
 	uint8_t reg_val = 0x00;
 
 	int parsed = -1;
+	struct i2c_bench_opts bench = {
+		.count = 1000,
+		.size = 1,
+		.reg_bytes = 2,
+	};
+	struct i2c_bench_result bench_res;
 
 #if DEBUG_ON
 	printf("argc: %d\n", argc);
 #endif
 
 	while (arg != -1) {
-		arg = getopt(argc, argv, "w:r:h");
+		arg = getopt(argc, argv, "w:r:b:h");
 		switch (arg) {
 		case 'w':
 			{
@@ -421,6 +432,38 @@ int main(int argc, char *argv[])
 				}
 			}
 			break;
+		case 'b':
+			{
+				readwrite = BENCH;
+				index = optind - 1;
+				if (index + 6 > argc) {
+					printf("Error not enough args\n");
+					goto error_handler;
+				}
+
+				adapter_nr = atoi(argv[index++]);
+				bench.addr = (uint16_t) strtol(argv[index++], NULL, 0);
+				switch (*argv[index++]) {
+				case 's':
+				case 'S':
+					bench.reg_bytes = 2;
+					break;
+				case 'b':
+				case 'B':
+					bench.reg_bytes = 1;
+					break;
+				default:
+					printf("Invalid size opiton\n");
+					goto error_handler;
+				}
+				bench.reg = (uint16_t) strtol(argv[index++], NULL, 0);
+				bench.count = strtoul(argv[index++], NULL, 0);
+				bench.size = strtoul(argv[index++], NULL, 0);
+				if (index < argc && (*argv[index] == 'w' ||
+						     *argv[index] == 'W'))
+					bench.write = 1;
+			}
+			break;
 		case -1:
 			if (arg_count == 0)
 				goto error_handler;
@@ -444,15 +487,22 @@ int main(int argc, char *argv[])
 			exit(1);
 		}
 
-		/* open device to communicate with */
-		if (ioctl(file, I2C_SLAVE_FORCE, dev_addr) < 0) {
+		/* open device to communicate with; the benchmark binds its own */
+		if (readwrite != BENCH &&
+		    ioctl(file, I2C_SLAVE_FORCE, dev_addr) < 0) {
 			/* ERROR HANDLING; you can check errno to see what went wrong */
 			printf("Error setting slave device\n");
 			close(file);
 			exit(1);
 		}
 
-		if (readwrite == WRITE) {
+		if (readwrite == BENCH) {
+			ret = i2c_bench_run(file, &bench, &bench_res);
+			if (ret)
+				printf("\nBenchmark failed: %s\n", strerror(-ret));
+			else
+				i2c_bench_report(stdout, &bench, &bench_res);
+		} else if (readwrite == WRITE) {
 			if (write_sccb_register(reg_addr, reg_val, datawidth)) {
 				printf("\nFailed to write register\n");
 
@@ -0,0 +1,236 @@
+/*
+ * i2c_bench - transaction latency and throughput benchmark
+ *
+ * Shared by sccb_tool and i2cscan. Issues a fixed number of reads or
+ * writes to one slave and records every transaction's latency in a
+ * log-linear histogram.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+
+#include "i2c_bench.h"
+
+#define I2C_BENCH_MAX_SIZE	4096
+
+void i2c_hist_init(struct i2c_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+static unsigned int i2c_hist_index(uint64_t v)
+{
+	unsigned int shift;
+
+	if (v < 2 * I2C_HIST_SUB)
+		return v;
+	shift = 63 - __builtin_clzll(v) - I2C_HIST_SUB_BITS;
+	if (shift > I2C_HIST_MAX_SHIFT)
+		return I2C_HIST_BUCKETS - 1;
+	return shift * I2C_HIST_SUB + (v >> shift);
+}
+
+/* middle of the value range covered by bucket idx */
+static uint64_t i2c_hist_value(unsigned int idx)
+{
+	unsigned int shift = idx < 2 * I2C_HIST_SUB ? 0 : idx / I2C_HIST_SUB - 1;
+	uint64_t sub = idx - shift * I2C_HIST_SUB;
+
+	return (sub << shift) + ((1ULL << shift) >> 1);
+}
+
+void i2c_hist_record(struct i2c_hist *h, uint64_t value)
+{
+	h->buckets[i2c_hist_index(value)]++;
+	h->count++;
+	h->sum += value;
+	if (value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+}
+
+uint64_t i2c_hist_percentile(const struct i2c_hist *h, double pct)
+{
+	uint64_t want, seen = 0;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+	want = (uint64_t)(pct / 100.0 * h->count + 0.5);
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < I2C_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want) {
+			uint64_t v = i2c_hist_value(i);
+
+			/* bucket midpoints may fall outside what was seen */
+			if (v < h->min)
+				v = h->min;
+			if (v > h->max)
+				v = h->max;
+			return v;
+		}
+	}
+	return h->max;
+}
+
+static uint64_t i2c_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* one transaction through I2C_RDWR: [reg] + payload, or [reg] then a read */
+static int i2c_bench_rdwr(int fd, const struct i2c_bench_opts *opts,
+			  unsigned char *buf)
+{
+	struct i2c_msg msgs[2];
+	struct i2c_rdwr_ioctl_data rdwr = { msgs, 0 };
+	unsigned char regbuf[2];
+
+	if (opts->reg_bytes == 2) {
+		regbuf[0] = opts->reg >> 8;
+		regbuf[1] = opts->reg & 0xff;
+	} else {
+		regbuf[0] = opts->reg & 0xff;
+	}
+
+	if (opts->write) {
+		/* buf holds room for the register bytes in front of the payload */
+		memcpy(buf, regbuf, opts->reg_bytes);
+		msgs[0].addr = opts->addr;
+		msgs[0].flags = 0;
+		msgs[0].len = opts->reg_bytes + opts->size;
+		msgs[0].buf = buf;
+		rdwr.nmsgs = 1;
+	} else {
+		if (opts->reg_bytes) {
+			msgs[rdwr.nmsgs].addr = opts->addr;
+			msgs[rdwr.nmsgs].flags = 0;
+			msgs[rdwr.nmsgs].len = opts->reg_bytes;
+			msgs[rdwr.nmsgs].buf = regbuf;
+			rdwr.nmsgs++;
+		}
+		msgs[rdwr.nmsgs].addr = opts->addr;
+		msgs[rdwr.nmsgs].flags = I2C_M_RD;
+		msgs[rdwr.nmsgs].len = opts->size;
+		msgs[rdwr.nmsgs].buf = buf;
+		rdwr.nmsgs++;
+	}
+
+	return ioctl(fd, I2C_RDWR, &rdwr) < 0 ? -errno : 0;
+}
+
+/* one transaction on SMBus-only adapters: byte data or I2C block data */
+static int i2c_bench_smbus(int fd, const struct i2c_bench_opts *opts,
+			   unsigned char *buf)
+{
+	struct i2c_smbus_ioctl_data args;
+	union i2c_smbus_data data;
+
+	args.read_write = opts->write ? I2C_SMBUS_WRITE : I2C_SMBUS_READ;
+	args.command = opts->reg & 0xff;
+	args.data = &data;
+	if (opts->size == 1) {
+		args.size = I2C_SMBUS_BYTE_DATA;
+		data.byte = buf[0];
+	} else {
+		args.size = I2C_SMBUS_I2C_BLOCK_DATA;
+		data.block[0] = opts->size;
+		memcpy(&data.block[1], buf, opts->size);
+	}
+
+	return ioctl(fd, I2C_SMBUS, &args) < 0 ? -errno : 0;
+}
+
+int i2c_bench_run(int fd, const struct i2c_bench_opts *opts,
+		  struct i2c_bench_result *res)
+{
+	static unsigned char buf[2 + I2C_BENCH_MAX_SIZE];
+	int (*xfer)(int, const struct i2c_bench_opts *, unsigned char *);
+	unsigned long funcs;
+	unsigned int i;
+	uint64_t start, t0, t1;
+
+	memset(res, 0, sizeof(*res));
+	i2c_hist_init(&res->hist);
+
+	if (!opts->count || !opts->size || opts->size > I2C_BENCH_MAX_SIZE ||
+	    opts->reg_bytes > 2)
+		return -EINVAL;
+
+	if (ioctl(fd, I2C_FUNCS, &funcs) < 0)
+		return -errno;
+
+	if (funcs & I2C_FUNC_I2C) {
+		xfer = i2c_bench_rdwr;
+		res->method = "i2c";
+	} else if (opts->reg_bytes == 1 &&
+		   ((opts->size == 1 &&
+		     (funcs & (opts->write ? I2C_FUNC_SMBUS_WRITE_BYTE_DATA :
+			       I2C_FUNC_SMBUS_READ_BYTE_DATA))) ||
+		    (opts->size <= I2C_SMBUS_BLOCK_MAX &&
+		     (funcs & (opts->write ? I2C_FUNC_SMBUS_WRITE_I2C_BLOCK :
+			       I2C_FUNC_SMBUS_READ_I2C_BLOCK))))) {
+		xfer = i2c_bench_smbus;
+		res->method = "smbus";
+		/* forced, as I2C_RDWR is: the slave may have a driver bound */
+		if (ioctl(fd, I2C_SLAVE_FORCE, opts->addr) < 0)
+			return -errno;
+	} else {
+		return -EOPNOTSUPP;
+	}
+
+	/* a recognisable pattern for writes, after the register bytes */
+	for (i = 0; i < opts->size; i++)
+		buf[(xfer == i2c_bench_rdwr ? opts->reg_bytes : 0) + i] = i;
+
+	start = i2c_bench_now();
+	for (i = 0; i < opts->count; i++) {
+		t0 = i2c_bench_now();
+		if (xfer(fd, opts, buf)) {
+			res->errors++;
+			continue;
+		}
+		t1 = i2c_bench_now();
+		i2c_hist_record(&res->hist, t1 - t0);
+		res->bytes += opts->size;
+	}
+	res->elapsed_ns = i2c_bench_now() - start;
+	return 0;
+}
+
+void i2c_bench_report(FILE *f, const struct i2c_bench_opts *opts,
+		      const struct i2c_bench_result *res)
+{
+	const struct i2c_hist *h = &res->hist;
+
+	fprintf(f, "%s benchmark: addr 0x%02X, %u x %u bytes, %s transfers\n",
+		opts->write ? "write" : "read", opts->addr, opts->count,
+		opts->size, res->method ? res->method : "no");
+	fprintf(f, "  ok %llu  errors %u  elapsed %.3f ms\n",
+		(unsigned long long)h->count, res->errors,
+		res->elapsed_ns / 1e6);
+	if (!h->count)
+		return;
+	fprintf(f, "  latency us: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f  mean %.1f\n",
+		h->min / 1e3,
+		i2c_hist_percentile(h, 50) / 1e3,
+		i2c_hist_percentile(h, 90) / 1e3,
+		i2c_hist_percentile(h, 99) / 1e3,
+		h->max / 1e3,
+		(double)h->sum / h->count / 1e3);
+	fprintf(f, "  throughput: %.0f bytes/s payload, %.0f transactions/s\n",
+		res->bytes * 1e9 / res->elapsed_ns,
+		h->count * 1e9 / res->elapsed_ns);
+}
@@ -0,0 +1,53 @@
+#ifndef __I2C_BENCH_H__
+#define __I2C_BENCH_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Latency histogram with HdrHistogram-style log-linear buckets: values
+ * below 2 * I2C_HIST_SUB are exact, above that every power of two is
+ * split into I2C_HIST_SUB buckets, so any value is recorded within
+ * about 3% (1 / I2C_HIST_SUB) of its real size.
+ */
+#define I2C_HIST_SUB_BITS	5
+#define I2C_HIST_SUB		(1 << I2C_HIST_SUB_BITS)
+#define I2C_HIST_MAX_SHIFT	36	/* ~2^41 ns, longer samples saturate */
+#define I2C_HIST_BUCKETS	((I2C_HIST_MAX_SHIFT + 2) * I2C_HIST_SUB)
+
+struct i2c_hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t buckets[I2C_HIST_BUCKETS];
+};
+
+void i2c_hist_init(struct i2c_hist *h);
+void i2c_hist_record(struct i2c_hist *h, uint64_t value);
+uint64_t i2c_hist_percentile(const struct i2c_hist *h, double pct);
+
+struct i2c_bench_opts {
+	uint16_t addr;		/* 7-bit slave address */
+	int write;		/* 0: read transactions, 1: write transactions */
+	unsigned int count;	/* number of transactions */
+	unsigned int size;	/* payload bytes per transaction */
+	unsigned int reg_bytes;	/* register offset sent first: 0, 1 or 2 bytes */
+	uint16_t reg;
+};
+
+struct i2c_bench_result {
+	struct i2c_hist hist;	/* per-transaction latency in ns */
+	unsigned int errors;
+	uint64_t bytes;		/* payload bytes moved by successful transactions */
+	uint64_t elapsed_ns;
+	const char *method;	/* "i2c" or "smbus" */
+};
+
+/* fd is an open /dev/i2c-N; returns 0 or -errno if nothing could be run */
+int i2c_bench_run(int fd, const struct i2c_bench_opts *opts,
+		  struct i2c_bench_result *res);
+void i2c_bench_report(FILE *f, const struct i2c_bench_opts *opts,
+		      const struct i2c_bench_result *res);
+
+#endif
@@ -3,8 +3,15 @@
 #include <linux/seq_file.h>
 #include <linux/i2c.h>
 #include <linux/delay.h>
+#include <linux/workqueue.h>
+#include <linux/bitmap.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
 
-//i2cdetect all
+#include "i2cdetect.h"
+
+//i2cdetect all, every adapter is scanned in parallel
 //echo > /proc/i2cdetectall
 //cat  /proc/i2cdetectall
 
@@ -12,78 +19,354 @@
 //echo n > /proc/i2cdetect
 //cat /proc/i2cdetect
 
-#define I2C_ADAPTER_NUM  (128)
-unsigned char tbuf = 0;
-unsigned int i2c_bus;
+//scan options, accepted after the bus number or alone for i2cdetectall
+//  mode=write|quick|read|zero  probe with a 1-byte write (default), SMBus
+//                              quick write, SMBus receive byte or a
+//                              zero-length write
+//  range=0x03-0x77             only probe this address range
+//  skip=0x50-0x57,0x68         never probe these addresses
+//  timeout=<ms>                per-address adapter timeout, at most 1000
+//  retries=<n>                 extra attempts before an address is absent,
+//                              at most 10
+//echo "mode=quick range=0x08-0x77 skip=0x50-0x57 timeout=5" > /proc/i2cdetectall
+
+//binary snapshot of the last i2cdetect all, see i2cdetect.h
+//dd if=/proc/i2cdetect_bin bs=73744 count=1
+
+#define I2C_ADAPTER_NUM  I2CDETECT_MAX_BUS
+#define I2C_ADDR_NUM     I2CDETECT_MAX_ADDR
+/* the bus segment stays locked while an address is probed */
+#define I2C_SCAN_MAX_TIMEOUT_MS  1000
+#define I2C_SCAN_MAX_RETRIES     10
 unsigned int i2c_bus_count = 0;
-unsigned int i2c_bus_list[I2C_ADAPTER_NUM];
-unsigned char i2c_addr[256];
 
-struct i2c_msg msg = {
-	.flags = 0,
-	.buf = &tbuf,
-	.len = 1,
+struct i2c_scan_opts {
+	enum i2cdetect_probe_mode mode;
+	unsigned int first;
+	unsigned int last;
+	DECLARE_BITMAP(skip, I2C_ADDR_NUM);
+	unsigned int timeout_ms;	/* 0: keep the adapter's own timeout */
+	unsigned int retries;
 };
 
-static int i2c_detect_show(struct seq_file *m, void *v)
+/* one work item per adapter, so independent buses are probed concurrently */
+struct i2c_bus_scan {
+	struct work_struct work;
+	const struct i2c_scan_opts *opts;
+	unsigned int bus;
+	int err;
+	DECLARE_BITMAP(found, I2C_ADDR_NUM);
+	DECLARE_BITMAP(probed, I2C_ADDR_NUM);
+	u32 latency_us[I2C_ADDR_NUM];
+	u64 timestamp_ns;
+	u64 duration_ns;
+};
+
+static const char * const i2c_probe_names[] = {
+	[I2CDETECT_PROBE_WRITE] = "write",
+	[I2CDETECT_PROBE_QUICK] = "quick",
+	[I2CDETECT_PROBE_READ] = "read",
+	[I2CDETECT_PROBE_ZERO] = "zero",
+};
+
+static struct i2c_scan_opts i2c_single_opts;
+static struct i2c_scan_opts i2c_all_opts;
+static struct i2c_bus_scan i2c_single;
+static struct i2c_bus_scan i2c_scan[I2C_ADAPTER_NUM];
+static struct workqueue_struct *i2c_detect_wq;
+static DEFINE_MUTEX(i2c_scan_lock);
+
+static void i2c_scan_opts_init(struct i2c_scan_opts *opts)
+{
+	opts->mode = I2CDETECT_PROBE_WRITE;
+	opts->first = 0x1;
+	opts->last = 0x7f;
+	bitmap_zero(opts->skip, I2C_ADDR_NUM);
+	opts->timeout_ms = 0;
+	opts->retries = 0;
+}
+
+/* "0x50" or "0x50-0x57" */
+static int i2c_parse_addr_range(char *s, unsigned int *first, unsigned int *last)
 {
-	unsigned char addr;
-	seq_printf(m, "scan i2c_%d bus:\n", i2c_bus);
-	for (addr = 0x1; addr < 0x80; addr++) {
-		if (i2c_addr[addr] != 0xff)
-			seq_printf(m, "0x%X ", i2c_addr[addr]);
+	char *dash = strchr(s, '-');
+
+	if (dash)
+		*dash++ = '\0';
+	if (kstrtouint(s, 0, first))
+		return -EINVAL;
+	if (!dash)
+		*last = *first;
+	else if (kstrtouint(dash, 0, last))
+		return -EINVAL;
+	if (*first > *last || *last >= I2C_ADDR_NUM)
+		return -EINVAL;
+	return 0;
+}
+
+static int i2c_scan_opts_parse(struct i2c_scan_opts *opts, char *s)
+{
+	char *tok, *val, *item;
+	unsigned int first, last;
+	int i;
+
+	while ((tok = strsep(&s, " \t\n")) != NULL) {
+		if (!*tok)
+			continue;
+		val = strchr(tok, '=');
+		if (!val)
+			return -EINVAL;
+		*val++ = '\0';
+
+		if (!strcmp(tok, "mode")) {
+			i = match_string(i2c_probe_names,
+					 ARRAY_SIZE(i2c_probe_names), val);
+			if (i < 0)
+				return -EINVAL;
+			opts->mode = i;
+		} else if (!strcmp(tok, "range")) {
+			if (i2c_parse_addr_range(val, &first, &last))
+				return -EINVAL;
+			opts->first = first;
+			opts->last = last;
+		} else if (!strcmp(tok, "skip")) {
+			while ((item = strsep(&val, ",")) != NULL) {
+				if (i2c_parse_addr_range(item, &first, &last))
+					return -EINVAL;
+				bitmap_set(opts->skip, first, last - first + 1);
+			}
+		} else if (!strcmp(tok, "timeout")) {
+			if (kstrtouint(val, 0, &opts->timeout_ms) ||
+			    opts->timeout_ms > I2C_SCAN_MAX_TIMEOUT_MS)
+				return -EINVAL;
+		} else if (!strcmp(tok, "retries")) {
+			if (kstrtouint(val, 0, &opts->retries) ||
+			    opts->retries > I2C_SCAN_MAX_RETRIES)
+				return -EINVAL;
+		} else {
+			return -EINVAL;
+		}
 	}
-	seq_printf(m, "\n");
 	return 0;
 }
 
-ssize_t i2c_detect_write(struct file * file, const char __user * buffer,
-			 size_t count, loff_t * ppos)
+static u32 i2c_probe_funcs(enum i2cdetect_probe_mode mode)
 {
-	int addr;
+	switch (mode) {
+	case I2CDETECT_PROBE_QUICK:
+		return I2C_FUNC_SMBUS_QUICK;
+	case I2CDETECT_PROBE_READ:
+		return I2C_FUNC_SMBUS_READ_BYTE;
+	case I2CDETECT_PROBE_ZERO:
+	case I2CDETECT_PROBE_WRITE:
+	default:
+		return I2C_FUNC_I2C;
+	}
+}
+
+/* zero-length writes also need an adapter without the quirk refusing them */
+static bool i2c_probe_supported(struct i2c_adapter *adapter,
+				enum i2cdetect_probe_mode mode)
+{
+	if (!i2c_check_functionality(adapter, i2c_probe_funcs(mode)))
+		return false;
+	if (mode == I2CDETECT_PROBE_ZERO && adapter->quirks &&
+	    (adapter->quirks->flags & I2C_AQ_NO_ZERO_LEN_WRITE))
+		return false;
+	return true;
+}
+
+/*
+ * Probe one address with the bus segment locked, so the per-scan timeout
+ * can be swapped into the adapter without affecting other transfers.
+ */
+static int i2c_probe_addr(struct i2c_adapter *adapter, unsigned int addr,
+			  const struct i2c_scan_opts *opts)
+{
+	unsigned char buf = 0;
+	struct i2c_msg probe = {
+		.addr = addr,
+		.flags = 0,
+		.buf = &buf,
+		.len = 1,
+	};
+	union i2c_smbus_data data;
+	int timeout;
 	int ret;
+
+	i2c_lock_bus(adapter, I2C_LOCK_SEGMENT);
+	timeout = adapter->timeout;
+	if (opts->timeout_ms)
+		adapter->timeout = max(msecs_to_jiffies(opts->timeout_ms), 1UL);
+
+	switch (opts->mode) {
+	case I2CDETECT_PROBE_QUICK:
+		ret = __i2c_smbus_xfer(adapter, addr, 0, I2C_SMBUS_WRITE, 0,
+				       I2C_SMBUS_QUICK, NULL);
+		break;
+	case I2CDETECT_PROBE_READ:
+		ret = __i2c_smbus_xfer(adapter, addr, 0, I2C_SMBUS_READ, 0,
+				       I2C_SMBUS_BYTE, &data);
+		break;
+	case I2CDETECT_PROBE_ZERO:
+		probe.len = 0;
+		/* fall through */
+	case I2CDETECT_PROBE_WRITE:
+	default:
+		ret = __i2c_transfer(adapter, &probe, 1);
+		ret = ret == 1 ? 0 : (ret < 0 ? ret : -EIO);
+		break;
+	}
+
+	adapter->timeout = timeout;
+	i2c_unlock_bus(adapter, I2C_LOCK_SEGMENT);
+	return ret;
+}
+
+static void i2c_bus_scan_run(struct i2c_bus_scan *scan)
+{
+	const struct i2c_scan_opts *opts = scan->opts;
 	struct i2c_adapter *adapter;
-	memset(i2c_addr, 0xff, sizeof(i2c_addr));
+	unsigned int addr;
+	unsigned int try;
+	u64 start, t;
+	int ret;
 
-	i2c_bus = simple_strtoul(buffer, NULL, 10);
-	printk("i2c_bus=%d\n", i2c_bus);
+	bitmap_zero(scan->found, I2C_ADDR_NUM);
+	bitmap_zero(scan->probed, I2C_ADDR_NUM);
+	memset(scan->latency_us, 0, sizeof(scan->latency_us));
+	scan->timestamp_ns = ktime_get_real_ns();
+	scan->duration_ns = 0;
+	start = ktime_get_ns();
 
-	adapter = i2c_get_adapter(i2c_bus);
+	adapter = i2c_get_adapter(scan->bus);
 	if (!adapter) {
-		printk("get i2c_%d adapter err\n", i2c_bus);
-		return -ENODEV;
-	} else {
-		printk("get i2c_%d adapter ok\n", i2c_bus);
+		printk("get i2c-%d adapter err\n", scan->bus);
+		scan->err = -ENODEV;
+		return;
 	}
 
-	for (addr = 0x1; addr < 0x80; addr++) {
-		msg.addr = addr;
-		ret = i2c_transfer(adapter, &msg, 1);
-		if (ret > 0) {
-			printk("found i2c　addr 0x%X\n", addr);
-			i2c_addr[addr] = addr;
-		}
-	};
+	if (!i2c_probe_supported(adapter, opts->mode)) {
+		printk("i2c-%d can't do %s probes\n", scan->bus,
+		       i2c_probe_names[opts->mode]);
+		i2c_put_adapter(adapter);
+		scan->err = -EOPNOTSUPP;
+		return;
+	}
 
+	for (addr = opts->first; addr <= opts->last; addr++) {
+		if (test_bit(addr, opts->skip))
+			continue;
+		set_bit(addr, scan->probed);
+		for (try = 0; try <= opts->retries; try++) {
+			t = ktime_get_ns();
+			ret = i2c_probe_addr(adapter, addr, opts);
+			scan->latency_us[addr] = div_u64(ktime_get_ns() - t,
+							 NSEC_PER_USEC);
+			if (!ret) {
+				set_bit(addr, scan->found);
+				break;
+			}
+		}
+	}
 	i2c_put_adapter(adapter);
+	scan->duration_ns = ktime_get_ns() - start;
+	scan->err = 0;
+}
+
+static void i2c_bus_scan_work(struct work_struct *work)
+{
+	i2c_bus_scan_run(container_of(work, struct i2c_bus_scan, work));
+}
+
+static void i2c_bus_scan_print(struct seq_file *m, struct i2c_bus_scan *scan)
+{
+	unsigned int addr;
+
+	seq_printf(m, "Scan iic bus%02d:", scan->bus);
+	if (scan->err)
+		seq_printf(m, "  error %d", scan->err);
+	for_each_set_bit(addr, scan->found, I2C_ADDR_NUM)
+		seq_printf(m, "  0x%02X(%uus)", addr, scan->latency_us[addr]);
+	seq_printf(m, "  [%s, at %llu.%06llu, %llu us]\n",
+		   scan->opts ? i2c_probe_names[scan->opts->mode] : "none",
+		   scan->timestamp_ns / NSEC_PER_SEC,
+		   (scan->timestamp_ns % NSEC_PER_SEC) / NSEC_PER_USEC,
+		   scan->duration_ns / NSEC_PER_USEC);
+}
+
+static void i2c_bus_scan_export(struct i2c_bus_scan *scan,
+				struct i2cdetect_bus_result *r)
+{
+	unsigned int addr;
+
+	memset(r, 0, sizeof(*r));
+	r->bus = scan->bus;
+	r->err = scan->err;
+	for_each_set_bit(addr, scan->found, I2C_ADDR_NUM)
+		r->present[addr / 64] |= 1ULL << (addr % 64);
+	for_each_set_bit(addr, scan->probed, I2C_ADDR_NUM)
+		r->probed[addr / 64] |= 1ULL << (addr % 64);
+	r->timestamp_ns = scan->timestamp_ns;
+	r->duration_ns = scan->duration_ns;
+	r->mode = scan->opts ? scan->opts->mode : I2CDETECT_PROBE_WRITE;
+	memcpy(r->latency_us, scan->latency_us, sizeof(r->latency_us));
+}
+
+static int i2c_detect_show(struct seq_file *m, void *v)
+{
+	mutex_lock(&i2c_scan_lock);
+	i2c_bus_scan_print(m, &i2c_single);
+	mutex_unlock(&i2c_scan_lock);
+	return 0;
+}
+
+ssize_t i2c_detect_write(struct file * file, const char __user * buffer,
+			 size_t count, loff_t * ppos)
+{
+	char kbuf[256];
+	char *s = kbuf;
+	char *tok;
+	unsigned int bus;
+	struct i2c_scan_opts opts;
+	size_t len = min(count, sizeof(kbuf) - 1);
+	int err;
+
+	if (copy_from_user(kbuf, buffer, len))
+		return -EFAULT;
+	kbuf[len] = '\0';
+
+	s = skip_spaces(s);
+	tok = strsep(&s, " \t\n");
+	if (kstrtouint(tok, 10, &bus))
+		return -EINVAL;
+	printk("i2c_bus=%d\n", bus);
+
+	i2c_scan_opts_init(&opts);
+	if (s && i2c_scan_opts_parse(&opts, s))
+		return -EINVAL;
+
+	mutex_lock(&i2c_scan_lock);
+	i2c_single_opts = opts;
+	i2c_single.opts = &i2c_single_opts;
+	i2c_single.bus = bus;
+	i2c_bus_scan_run(&i2c_single);
+	err = i2c_single.err;
+	mutex_unlock(&i2c_scan_lock);
+
+	if (err)
+		return err;
 	return count;
 }
 
-//0xff addr1 addr2 0xff addr3 addr4 0xff
 static int i2c_detect_all_show(struct seq_file *m, void *v)
 {
-	int i = 0;
-	int j = 0;
+	int i;
 
-	for (i = 0; i < i2c_bus_count; i++) {
-		seq_printf(m, "Scan iic bus%02d:", i2c_bus_list[i]);
-		j++;
-		while (i2c_addr[j] != 0xff) {
-			seq_printf(m, "  0x%02X", i2c_addr[j]);
-			j++;
-		}
-		seq_printf(m, "\n");
-	}
+	mutex_lock(&i2c_scan_lock);
+	for (i = 0; i < i2c_bus_count; i++)
+		i2c_bus_scan_print(m, &i2c_scan[i]);
+	mutex_unlock(&i2c_scan_lock);
 	return 0;
 }
 
@@ -91,35 +374,63 @@ ssize_t i2c_detect_all_write(struct file * file, const char __user * buffer,
 			     size_t count, loff_t * ppos)
 {
 	int i;
-	int ret;
-	int addr;
-	int addr_count = 0;
-	struct i2c_adapter *adapter;
-	memset(i2c_addr, 0xff, sizeof(i2c_addr));
+	unsigned int addr;
+	char kbuf[256];
+	struct i2c_scan_opts opts;
+	size_t len = min(count, sizeof(kbuf) - 1);
+
+	if (copy_from_user(kbuf, buffer, len))
+		return -EFAULT;
+	kbuf[len] = '\0';
+
+	i2c_scan_opts_init(&opts);
+	if (i2c_scan_opts_parse(&opts, kbuf))
+		return -EINVAL;
 
+	mutex_lock(&i2c_scan_lock);
+	i2c_all_opts = opts;
 	for (i = 0; i < i2c_bus_count; i++) {
-		adapter = i2c_get_adapter(i2c_bus_list[i]);
-		if (!adapter) {
-			printk("get i2c-%d adapter err\n", i);
-			return -ENODEV;
-		}
+		i2c_scan[i].opts = &i2c_all_opts;
+		queue_work(i2c_detect_wq, &i2c_scan[i].work);
+	}
 
-		addr_count++;
+	/* the write completes only once every bus has been scanned */
+	flush_workqueue(i2c_detect_wq);
 
-		printk(KERN_CONT "\nDetect i2c-%02d:", i2c_bus_list[i]);
-		for (addr = 0x1; addr < 0x80; addr++) {
-			msg.addr = addr;
-			ret = i2c_transfer(adapter, &msg, 1);
-			if (ret > 0) {
-				printk(KERN_CONT "\t0x%02X",addr);
-				i2c_addr[addr_count++] = addr;
-			}
-		};
-		i2c_put_adapter(adapter);
+	for (i = 0; i < i2c_bus_count; i++) {
+		printk(KERN_CONT "\nDetect i2c-%02d:", i2c_scan[i].bus);
+		for_each_set_bit(addr, i2c_scan[i].found, I2C_ADDR_NUM)
+			printk(KERN_CONT "\t0x%02X", addr);
 	}
+	mutex_unlock(&i2c_scan_lock);
 	return count;
 }
 
+ssize_t i2c_detect_bin_read(struct file *file, char __user *buffer,
+			    size_t count, loff_t *ppos)
+{
+	static u8 snapshot[I2CDETECT_BIN_MAX_SIZE];
+	struct i2cdetect_bin_header *hdr = (struct i2cdetect_bin_header *)snapshot;
+	struct i2cdetect_bus_result *r = (struct i2cdetect_bus_result *)(hdr + 1);
+	size_t size;
+	ssize_t ret;
+	int i;
+
+	mutex_lock(&i2c_scan_lock);
+	hdr->magic = I2CDETECT_BIN_MAGIC;
+	hdr->version = I2CDETECT_BIN_VERSION;
+	hdr->record_size = sizeof(*r);
+	hdr->nr_bus = i2c_bus_count;
+	hdr->reserved = 0;
+	for (i = 0; i < i2c_bus_count; i++)
+		i2c_bus_scan_export(&i2c_scan[i], &r[i]);
+	size = sizeof(*hdr) + i2c_bus_count * sizeof(*r);
+
+	ret = simple_read_from_buffer(buffer, count, ppos, snapshot, size);
+	mutex_unlock(&i2c_scan_lock);
+	return ret;
+}
+
 static int i2c_detect_open(struct inode *inode, struct file *file)
 {
 	return single_open(file, i2c_detect_show, NULL);
@@ -144,17 +455,24 @@ static const struct file_operations i2c_detect_all_fops = {
 	.write = i2c_detect_all_write,
 };
 
+static const struct file_operations i2c_detect_bin_fops = {
+	.owner = THIS_MODULE,
+	.read = i2c_detect_bin_read,
+	.llseek = default_llseek,
+};
+
 void i2c_bus_detect(void)
 {
 	int i;
 	struct i2c_adapter *adapter;
-	memset(i2c_bus_list, 0, sizeof(i2c_bus_list));
 
 	for (i = 0; i < I2C_ADAPTER_NUM; i++) {
 		adapter = i2c_get_adapter(i);
 		if (adapter) {
 		    printk("found i2c_bus: %02d\n", i);
-			i2c_bus_list[i2c_bus_count++] = i;
+			i2c_scan[i2c_bus_count].bus = i;
+			INIT_WORK(&i2c_scan[i2c_bus_count].work, i2c_bus_scan_work);
+			i2c_bus_count++;
 			i2c_put_adapter(adapter);
 		}
 	}
@@ -163,10 +481,14 @@ void i2c_bus_detect(void)
 
 static int __init i2c_detect_init(void)
 {
+	i2c_detect_wq = alloc_workqueue("i2cdetect", WQ_UNBOUND, I2C_ADAPTER_NUM);
+	if (!i2c_detect_wq)
+		return -ENOMEM;
+
 	i2c_bus_detect();
-	memset(i2c_addr, 0xff, sizeof(i2c_addr));
-	proc_create("i2cdetect", S_IRWXUGO, NULL, &i2c_detect_fops);
-	proc_create("i2cdetectall", S_IRWXUGO, NULL, &i2c_detect_all_fops);
+	proc_create("i2cdetect", S_IRUGO | S_IWUSR, NULL, &i2c_detect_fops);
+	proc_create("i2cdetectall", S_IRUGO | S_IWUSR, NULL, &i2c_detect_all_fops);
+	proc_create("i2cdetect_bin", S_IRUGO, NULL, &i2c_detect_bin_fops);
 	return 0;
 }
 
@@ -174,6 +496,8 @@ static void __exit i2c_detect_exit(void)
 {
 	remove_proc_entry("i2cdetect", NULL);
 	remove_proc_entry("i2cdetectall", NULL);
+	remove_proc_entry("i2cdetect_bin", NULL);
+	destroy_workqueue(i2c_detect_wq);
 }
 
 module_init(i2c_detect_init);
@@ -0,0 +1,63 @@
+#ifndef __I2CDETECT_H__
+#define __I2CDETECT_H__
+
+#include <linux/types.h>
+
+/*
+ * Binary scan results, as read from /proc/i2cdetect_bin.
+ *
+ * The file is one struct i2cdetect_bin_header followed by nr_bus
+ * struct i2cdetect_bus_result records, so a tool can fetch a whole
+ * snapshot with a single pread() of I2CDETECT_BIN_MAX_SIZE bytes.
+ */
+
+#define I2CDETECT_BIN_MAGIC	0x44433249	/* "I2CD" little endian */
+#define I2CDETECT_BIN_VERSION	2
+#define I2CDETECT_MAX_BUS	128
+#define I2CDETECT_MAX_ADDR	128
+
+/* how a single address is probed */
+enum i2cdetect_probe_mode {
+	I2CDETECT_PROBE_WRITE = 0,	/* 1-byte write of 0x00 (legacy) */
+	I2CDETECT_PROBE_QUICK = 1,	/* SMBus quick write */
+	I2CDETECT_PROBE_READ = 2,	/* SMBus receive byte */
+	I2CDETECT_PROBE_ZERO = 3,	/* zero-length I2C write */
+};
+
+struct i2cdetect_bin_header {
+	__u32 magic;
+	__u16 version;
+	__u16 record_size;	/* sizeof(struct i2cdetect_bus_result) */
+	__u32 nr_bus;
+	__u32 reserved;
+};
+
+struct i2cdetect_bus_result {
+	__u32 bus;
+	__s32 err;		/* 0 or -errno if the adapter could not be used */
+	__u64 present[2];	/* address n acked: present[n / 64] & (1 << n % 64) */
+	__u64 probed[2];	/* address n was probed, same layout as present */
+	__u64 timestamp_ns;	/* CLOCK_REALTIME when the scan started */
+	__u64 duration_ns;	/* time spent scanning this bus */
+	__u32 mode;		/* enum i2cdetect_probe_mode */
+	__u32 reserved;
+	__u32 latency_us[I2CDETECT_MAX_ADDR];	/* last probe of each address */
+};
+
+#define I2CDETECT_BIN_MAX_SIZE \
+	(sizeof(struct i2cdetect_bin_header) + \
+	 I2CDETECT_MAX_BUS * sizeof(struct i2cdetect_bus_result))
+
+static inline int i2cdetect_addr_present(const struct i2cdetect_bus_result *r,
+					 unsigned int addr)
+{
+	return (r->present[addr / 64] >> (addr % 64)) & 1;
+}
+
+static inline int i2cdetect_addr_probed(const struct i2cdetect_bus_result *r,
+					unsigned int addr)
+{
+	return (r->probed[addr / 64] >> (addr % 64)) & 1;
+}
+
+#endif
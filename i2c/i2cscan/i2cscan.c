@@ -0,0 +1,482 @@
+/*
+ * i2cscan - userspace companion of the i2cdetect kernel module
+ *
+ * Scans every /dev/i2c-* adapter concurrently, one thread per adapter,
+ * and reports the results in the same text and binary formats as
+ * /proc/i2cdetectall and /proc/i2cdetect_bin.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <stdint.h>
+
+#include "i2cdetect.h"
+#include "i2c_bench.h"
+
+#define PROBE_AUTO	(-1)
+
+struct scan_opts {
+	int mode;		/* enum i2cdetect_probe_mode or PROBE_AUTO */
+	unsigned int first;
+	unsigned int last;
+	__u64 skip[2];
+	unsigned int retries;
+};
+
+struct bus_scan {
+	pthread_t thread;
+	int started;
+	const struct scan_opts *opts;
+	struct i2cdetect_bus_result res;
+};
+
+static const char *probe_names[] = {
+	[I2CDETECT_PROBE_WRITE] = "write",
+	[I2CDETECT_PROBE_QUICK] = "quick",
+	[I2CDETECT_PROBE_READ] = "read",
+	[I2CDETECT_PROBE_ZERO] = "zero",
+};
+
+static struct bus_scan scans[I2CDETECT_MAX_BUS];
+static unsigned int nr_scans;
+
+static void display_menu(void)
+{
+	printf("I2C Scan\n");
+	printf("i2cscan [-a bus] [-m write|quick|read|zero] [-R first-last]\n"
+	       "        [-s addr[-addr],...] [-n retries]\n"
+	       "        [-b out.bin] [-r in.bin]\n"
+	       "i2cscan -a bus -B addr [-N count] [-S size] [-W] [-c reg]\n\n");
+	printf("  -a  scan only this adapter (may be repeated)\n");
+	printf("  -m  probe method, default quick (read if quick is unsupported)\n");
+	printf("  -b  write the binary result format of /proc/i2cdetect_bin\n");
+	printf("  -r  decode a binary result file, e.g. /proc/i2cdetect_bin\n");
+	printf("  -B  benchmark <count> transactions of <size> bytes against addr,\n"
+	       "      reading (or writing with -W) from 8-bit register <reg>\n\n");
+}
+
+static uint64_t now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bit_set(__u64 *map, unsigned int n)
+{
+	map[n / 64] |= 1ULL << (n % 64);
+}
+
+static int bit_test(const __u64 *map, unsigned int n)
+{
+	return (map[n / 64] >> (n % 64)) & 1;
+}
+
+/* "0x50" or "0x50-0x57" */
+static int parse_addr_range(const char *s, unsigned int *first, unsigned int *last)
+{
+	char *end;
+
+	*first = strtoul(s, &end, 0);
+	if (end == s)
+		return -1;
+	if (*end == '-')
+		*last = strtoul(end + 1, &end, 0);
+	else
+		*last = *first;
+	if (*end != '\0' || *first > *last || *last >= I2CDETECT_MAX_ADDR)
+		return -1;
+	return 0;
+}
+
+static int parse_skip_list(char *s, __u64 *skip)
+{
+	char *item;
+	unsigned int first, last;
+
+	for (item = strtok(s, ","); item; item = strtok(NULL, ",")) {
+		if (parse_addr_range(item, &first, &last))
+			return -1;
+		for (; first <= last; first++)
+			bit_set(skip, first);
+	}
+	return 0;
+}
+
+static unsigned long probe_funcs(int mode)
+{
+	switch (mode) {
+	case I2CDETECT_PROBE_QUICK:
+		return I2C_FUNC_SMBUS_QUICK;
+	case I2CDETECT_PROBE_READ:
+		return I2C_FUNC_SMBUS_READ_BYTE;
+	case I2CDETECT_PROBE_ZERO:
+	case I2CDETECT_PROBE_WRITE:
+	default:
+		return I2C_FUNC_I2C;
+	}
+}
+
+static int i2c_smbus_access(int fd, char rw, int size,
+			    union i2c_smbus_data *data)
+{
+	struct i2c_smbus_ioctl_data args;
+
+	args.read_write = rw;
+	args.command = 0;
+	args.size = size;
+	args.data = data;
+	return ioctl(fd, I2C_SMBUS, &args);
+}
+
+static int probe_addr(int fd, unsigned int addr, int mode)
+{
+	unsigned char buf = 0;
+	struct i2c_msg msg = {
+		.addr = addr,
+		.flags = 0,
+		.len = 1,
+		.buf = &buf,
+	};
+	struct i2c_rdwr_ioctl_data rdwr = { &msg, 1 };
+	union i2c_smbus_data data;
+
+	switch (mode) {
+	case I2CDETECT_PROBE_QUICK:
+	case I2CDETECT_PROBE_READ:
+		/*
+		 * Forced, so an address bound to a kernel driver is probed
+		 * too, as the module and the I2C_RDWR probes below do.
+		 */
+		if (ioctl(fd, I2C_SLAVE_FORCE, addr) < 0)
+			return -errno;
+		if (mode == I2CDETECT_PROBE_QUICK)
+			return i2c_smbus_access(fd, I2C_SMBUS_WRITE,
+						I2C_SMBUS_QUICK, NULL) < 0 ? -errno : 0;
+		return i2c_smbus_access(fd, I2C_SMBUS_READ,
+					I2C_SMBUS_BYTE, &data) < 0 ? -errno : 0;
+	case I2CDETECT_PROBE_ZERO:
+		msg.len = 0;
+		/* fall through */
+	case I2CDETECT_PROBE_WRITE:
+	default:
+		return ioctl(fd, I2C_RDWR, &rdwr) == 1 ? 0 : -errno;
+	}
+}
+
+static void *scan_thread(void *arg)
+{
+	struct bus_scan *scan = arg;
+	struct i2cdetect_bus_result *r = &scan->res;
+	const struct scan_opts *opts = scan->opts;
+	char filename[32];
+	unsigned long funcs;
+	unsigned int addr, try;
+	uint64_t start, t;
+	int mode = opts->mode;
+	int fd, ret;
+
+	r->timestamp_ns = now_ns(CLOCK_REALTIME);
+	r->mode = mode == PROBE_AUTO ? I2CDETECT_PROBE_QUICK : mode;
+	start = now_ns(CLOCK_MONOTONIC);
+
+	snprintf(filename, sizeof(filename), "/dev/i2c-%u", r->bus);
+	if ((fd = open(filename, O_RDWR)) < 0) {
+		r->err = -errno;
+		return NULL;
+	}
+
+	if (ioctl(fd, I2C_FUNCS, &funcs) < 0) {
+		r->err = -errno;
+		close(fd);
+		return NULL;
+	}
+
+	if (mode == PROBE_AUTO)
+		mode = (funcs & I2C_FUNC_SMBUS_QUICK) ?
+			I2CDETECT_PROBE_QUICK : I2CDETECT_PROBE_READ;
+	r->mode = mode;
+
+	if ((funcs & probe_funcs(mode)) != probe_funcs(mode)) {
+		r->err = -EOPNOTSUPP;
+		close(fd);
+		return NULL;
+	}
+
+	/*
+	 * No per-scan timeout as the module's timeout=: I2C_TIMEOUT sets it
+	 * for the whole adapter and for good, and the old value cannot be
+	 * read back to restore it.
+	 */
+	for (addr = opts->first; addr <= opts->last; addr++) {
+		if (bit_test(opts->skip, addr))
+			continue;
+		bit_set(r->probed, addr);
+		for (try = 0; try <= opts->retries; try++) {
+			t = now_ns(CLOCK_MONOTONIC);
+			ret = probe_addr(fd, addr, mode);
+			r->latency_us[addr] = (now_ns(CLOCK_MONOTONIC) - t) / 1000;
+			if (!ret) {
+				bit_set(r->present, addr);
+				break;
+			}
+		}
+	}
+
+	close(fd);
+	r->duration_ns = now_ns(CLOCK_MONOTONIC) - start;
+	return NULL;
+}
+
+static int bus_compare(const void *a, const void *b)
+{
+	return (int)((const struct bus_scan *)a)->res.bus -
+	       (int)((const struct bus_scan *)b)->res.bus;
+}
+
+static void add_bus(unsigned int bus, const struct scan_opts *opts)
+{
+	if (nr_scans >= I2CDETECT_MAX_BUS)
+		return;
+	memset(&scans[nr_scans], 0, sizeof(scans[nr_scans]));
+	scans[nr_scans].res.bus = bus;
+	scans[nr_scans].opts = opts;
+	nr_scans++;
+}
+
+static void find_adapters(const struct scan_opts *opts)
+{
+	DIR *dir;
+	struct dirent *de;
+	unsigned int bus;
+	char c;
+
+	if (!(dir = opendir("/dev"))) {
+		perror("/dev");
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (sscanf(de->d_name, "i2c-%u%c", &bus, &c) == 1 &&
+		    bus < I2CDETECT_MAX_BUS)
+			add_bus(bus, opts);
+	}
+	closedir(dir);
+	qsort(scans, nr_scans, sizeof(scans[0]), bus_compare);
+}
+
+/* same line layout as /proc/i2cdetectall */
+static void print_result(const struct i2cdetect_bus_result *r)
+{
+	unsigned int addr;
+
+	printf("Scan iic bus%02d:", r->bus);
+	if (r->err)
+		printf("  error %d", r->err);
+	for (addr = 0; addr < I2CDETECT_MAX_ADDR; addr++)
+		if (i2cdetect_addr_present(r, addr))
+			printf("  0x%02X(%uus)", addr, r->latency_us[addr]);
+	printf("  [%s, at %llu.%06llu, %llu us]\n",
+	       r->mode < 4 ? probe_names[r->mode] : "?",
+	       (unsigned long long)(r->timestamp_ns / 1000000000ULL),
+	       (unsigned long long)(r->timestamp_ns % 1000000000ULL) / 1000,
+	       (unsigned long long)(r->duration_ns / 1000));
+}
+
+static int run_bench(const struct i2c_bench_opts *bench)
+{
+	struct i2c_bench_result res;
+	char filename[32];
+	unsigned int i;
+	int fd, ret, err = 0;
+
+	for (i = 0; i < nr_scans; i++) {
+		snprintf(filename, sizeof(filename), "/dev/i2c-%u", scans[i].res.bus);
+		if ((fd = open(filename, O_RDWR)) < 0) {
+			perror(filename);
+			err = -1;
+			continue;
+		}
+		printf("i2c-%u: ", scans[i].res.bus);
+		ret = i2c_bench_run(fd, bench, &res);
+		close(fd);
+		if (ret) {
+			printf("benchmark failed: %s\n", strerror(-ret));
+			err = -1;
+			continue;
+		}
+		i2c_bench_report(stdout, bench, &res);
+	}
+	return err;
+}
+
+static int write_binary(const char *name)
+{
+	struct i2cdetect_bin_header hdr;
+	unsigned int i;
+	FILE *f;
+
+	f = strcmp(name, "-") ? fopen(name, "wb") : stdout;
+	if (!f) {
+		perror(name);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = I2CDETECT_BIN_MAGIC;
+	hdr.version = I2CDETECT_BIN_VERSION;
+	hdr.record_size = sizeof(struct i2cdetect_bus_result);
+	hdr.nr_bus = nr_scans;
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	for (i = 0; i < nr_scans; i++)
+		fwrite(&scans[i].res, sizeof(scans[i].res), 1, f);
+
+	if (f != stdout)
+		fclose(f);
+	return 0;
+}
+
+static int read_binary(const char *name)
+{
+	static unsigned char buf[I2CDETECT_BIN_MAX_SIZE];
+	struct i2cdetect_bin_header *hdr = (struct i2cdetect_bin_header *)buf;
+	struct i2cdetect_bus_result *r = (struct i2cdetect_bus_result *)(hdr + 1);
+	ssize_t len;
+	unsigned int i;
+	int fd;
+
+	if ((fd = open(name, O_RDONLY)) < 0) {
+		perror(name);
+		return -1;
+	}
+	len = pread(fd, buf, sizeof(buf), 0);
+	close(fd);
+
+	if (len < (ssize_t)sizeof(*hdr) || hdr->magic != I2CDETECT_BIN_MAGIC ||
+	    hdr->version != I2CDETECT_BIN_VERSION ||
+	    hdr->record_size != sizeof(*r) || hdr->nr_bus > I2CDETECT_MAX_BUS ||
+	    len < (ssize_t)(sizeof(*hdr) + hdr->nr_bus * sizeof(*r))) {
+		fprintf(stderr, "%s: not an i2cdetect v%d result file\n",
+			name, I2CDETECT_BIN_VERSION);
+		return -1;
+	}
+
+	for (i = 0; i < hdr->nr_bus; i++)
+		print_result(&r[i]);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct scan_opts opts = {
+		.mode = PROBE_AUTO,
+		.first = 0x1,
+		.last = 0x7f,
+	};
+	struct i2c_bench_opts bench = {
+		.count = 1000,
+		.size = 1,
+		.reg_bytes = 1,
+	};
+	int do_bench = 0;
+	const char *bin_out = NULL;
+	unsigned int i;
+	int arg, mode;
+
+	while ((arg = getopt(argc, argv, "a:m:R:s:n:b:r:B:N:S:Wc:h")) != -1) {
+		switch (arg) {
+		case 'a':
+			add_bus(strtoul(optarg, NULL, 0), &opts);
+			break;
+		case 'm':
+			for (mode = 0; mode < 4; mode++)
+				if (!strcmp(optarg, probe_names[mode]))
+					break;
+			if (mode == 4)
+				goto error_handler;
+			opts.mode = mode;
+			break;
+		case 'R':
+			if (parse_addr_range(optarg, &opts.first, &opts.last))
+				goto error_handler;
+			break;
+		case 's':
+			if (parse_skip_list(optarg, opts.skip))
+				goto error_handler;
+			break;
+		case 'n':
+			opts.retries = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bin_out = optarg;
+			break;
+		case 'r':
+			return read_binary(optarg) ? 1 : 0;
+		case 'B':
+			bench.addr = strtoul(optarg, NULL, 0);
+			do_bench = 1;
+			break;
+		case 'N':
+			bench.count = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			bench.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'W':
+			bench.write = 1;
+			break;
+		case 'c':
+			bench.reg = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			goto error_handler;
+		}
+	}
+
+	if (do_bench) {
+		if (!nr_scans)
+			goto error_handler;
+		return run_bench(&bench) ? 1 : 0;
+	}
+
+	if (!nr_scans)
+		find_adapters(&opts);
+	if (!nr_scans) {
+		fprintf(stderr, "no i2c adapters found\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_scans; i++) {
+		scans[i].started = !pthread_create(&scans[i].thread, NULL,
+						   scan_thread, &scans[i]);
+		if (!scans[i].started)
+			scan_thread(&scans[i]);	/* run inline if we can't spawn */
+	}
+	for (i = 0; i < nr_scans; i++)
+		if (scans[i].started)
+			pthread_join(scans[i].thread, NULL);
+
+	if (bin_out)
+		return write_binary(bin_out) ? 1 : 0;
+
+	for (i = 0; i < nr_scans; i++)
+		print_result(&scans[i].res);
+	return 0;
+
+ error_handler:
+	display_menu();
+	return 1;
+}
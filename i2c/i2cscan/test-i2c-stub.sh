@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Scan and benchmark an i2c-stub adapter with known chips, so i2cscan
+# can be checked without hardware. Needs root and the i2c-stub and
+# i2c-dev modules.
+#
+#   sudo ./test-i2c-stub.sh
+#
+
+CHIPS="0x1a 0x50 0x68"
+SCAN=${SCAN:-./i2cscan}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"; modprobe -r i2c-stub' EXIT
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+modprobe i2c-dev || fail "modprobe i2c-dev"
+modprobe i2c-stub chip_addr=$(echo $CHIPS | tr ' ' ',') || fail "modprobe i2c-stub"
+
+BUS=
+for a in /sys/class/i2c-adapter/i2c-*; do
+	if grep -q "SMBus stub driver" "$a/name"; then
+		BUS=${a##*/i2c-}
+	fi
+done
+[ -n "$BUS" ] || fail "no i2c-stub adapter"
+
+udevadm settle 2>/dev/null
+[ -c /dev/i2c-$BUS ] || fail "/dev/i2c-$BUS missing"
+
+# text output lists exactly the stub chips
+$SCAN -a $BUS > "$TMP/scan.txt" || fail "scan"
+cat "$TMP/scan.txt"
+FOUND=$(grep -o "0x[0-9A-F][0-9A-F](" "$TMP/scan.txt" | tr -d '(' | tr 'A-F' 'a-f' | xargs)
+[ "$FOUND" = "$CHIPS" ] || fail "found '$FOUND', expected '$CHIPS'"
+
+# read-byte probes find the same chips
+$SCAN -a $BUS -m read > "$TMP/read.txt" || fail "read scan"
+FOUND=$(grep -o "0x[0-9A-F][0-9A-F](" "$TMP/read.txt" | tr -d '(' | tr 'A-F' 'a-f' | xargs)
+[ "$FOUND" = "$CHIPS" ] || fail "read mode found '$FOUND'"
+
+# ranges and skip lists
+$SCAN -a $BUS -R 0x40-0x7f -s 0x68 > "$TMP/range.txt" || fail "range scan"
+FOUND=$(grep -o "0x[0-9A-F][0-9A-F](" "$TMP/range.txt" | tr -d '(' | tr 'A-F' 'a-f' | xargs)
+[ "$FOUND" = "0x50" ] || fail "range scan found '$FOUND'"
+
+# the binary format round-trips to the same text
+$SCAN -a $BUS -b "$TMP/scan.bin" || fail "binary scan"
+$SCAN -r "$TMP/scan.bin" > "$TMP/decoded.txt" || fail "decode"
+FOUND=$(grep -o "0x[0-9A-F][0-9A-F](" "$TMP/decoded.txt" | tr -d '(' | tr 'A-F' 'a-f' | xargs)
+[ "$FOUND" = "$CHIPS" ] || fail "decoded '$FOUND'"
+
+# benchmark reads and writes through SMBus byte and I2C block transfers
+for args in "-S 1" "-S 16" "-S 16 -W"; do
+	$SCAN -a $BUS -B 0x50 -N 200 $args > "$TMP/bench.txt" || fail "bench $args"
+	cat "$TMP/bench.txt"
+	grep -q "ok 200  errors 0" "$TMP/bench.txt" || fail "bench $args errors"
+	grep -q "p99" "$TMP/bench.txt" || fail "bench $args histogram"
+done
+
+echo "PASS"
@@ -1,5 +0,0 @@
-#define IDSTRING "fbv 1.1"
-#define DEFAULT_FRAMEBUFFER "/dev/fb0"
-#define FBV_SUPPORT_JPEG
-#define FBV_SUPPORT_PNG
-#define FBV_SUPPORT_BMP
@@ -15,6 +15,7 @@ static int opt_clear = 1;
 static int opt_hide_cursor = 1;
 static int opt_image_info = 1;
 static char *imagename = NULL;
+static struct fb_context fb;
 
 void setup_console(int t)
 {
@@ -45,48 +46,27 @@ void setup_console(int t)
 
 int show_image(char *filename)
 {
-	int (*load)(char *, unsigned char *, unsigned char **, int, int);
-
+	const struct fh_loader *l;
+	unsigned char hdr[FH_HEADER_LEN];
 	unsigned char * image = NULL;
 	unsigned char * alpha = NULL;
 
-	int c, ret;
+	int c, len, ret = 1;
 	int x_size, y_size, screen_width, screen_height;
 	int x_pan, y_pan, x_offs, y_offs, refresh = 1;
 	int retransform = 1, noshow = 0;
 
 	struct image i;
+	FILE *fh;
 
-#ifdef FBV_SUPPORT_PNG
-	if(fh_png_id(filename))
-	if(fh_png_getsize(filename, &x_size, &y_size) == FH_ERROR_OK)
-	{
-		load = fh_png_load;
-		goto identified;
-	}
-#endif
-
-#ifdef FBV_SUPPORT_JPEG
-	if(fh_jpeg_id(filename))
-	if(fh_jpeg_getsize(filename, &x_size, &y_size) == FH_ERROR_OK)
-	{
-		load = fh_jpeg_load;
-		goto identified;
-	}
-#endif
-
-#ifdef FBV_SUPPORT_BMP
-	if(fh_bmp_id(filename))
-	if(fh_bmp_getsize(filename, &x_size, &y_size) == FH_ERROR_OK)
+	memset(&i, 0, sizeof(i));
+	if(!(fh = fopen(filename, "rb")) || !(l = fh_identify(fh, hdr, &len, &x_size, &y_size)))
 	{
-		load = fh_bmp_load;
-		goto identified;
+		fprintf(stderr, "%s: Unable to access file or file format unknown.\n", filename);
+		if(fh)
+			fclose(fh);
+		return(1);
 	}
-#endif
-	fprintf(stderr, "%s: Unable to access file or file format unknown.\n", filename);
-	return(1);
-
-identified:
 
 	if(!(image = (unsigned char*)malloc(x_size * y_size * 3)))
 	{
@@ -94,13 +74,13 @@ identified:
 		goto error;
 	}
 
-	if(load(filename, image, &alpha, x_size, y_size) != FH_ERROR_OK)
+	if(l->load(fh, image, &alpha, x_size, y_size, NULL, NULL) != FH_ERROR_OK)
 	{
 		fprintf(stderr, "%s: Image data is corrupt?\n", filename);
 		goto error;
 	}
 
-	if(getCurrentRes(&screen_width, &screen_height))
+	if(getCurrentRes(&fb, &screen_width, &screen_height))
 		goto error;
 	i.do_free = 0;
 
@@ -108,6 +88,7 @@ identified:
 	{
 		if(retransform)
 		{
+			fb_image_invalidate(&i);
 			if(i.do_free)
 			{
 				free(i.rgb);
@@ -144,7 +125,7 @@ identified:
 			else
 				y_offs = 0;
 
-			if(fb_display(i.rgb, i.alpha, i.width, i.height, x_pan, y_pan, x_offs, y_offs))
+			if(fb_display(&fb, &i, x_pan, y_pan, x_offs, y_offs))
 				goto error;
 			refresh = 0;
 		}
@@ -180,7 +161,10 @@ done:
 	}
 
 error:
+	fclose(fh);
+	fb_image_invalidate(&i);
 	free(image);
+	free(alpha);
 	if(i.do_free)
 	{
 		free(i.rgb);
@@ -230,6 +214,9 @@ int main(int argc, char **argv)
 		fflush(stdout);
 	}
 
+	if(fb_open(&fb, NULL))
+		return 1;
+
 	setup_console(1);
 
 	i = optind;
@@ -246,6 +233,7 @@ int main(int argc, char **argv)
 	}
 
 	setup_console(0);
+	fb_close(&fb);
 
 	if(opt_hide_cursor)
 	{
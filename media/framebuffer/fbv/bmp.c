@@ -4,16 +4,24 @@
 #include "fbv.h"
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define BMP_TORASTER_OFFSET   10
+#define BMP_HEADER_OFFSET     14
 #define BMP_SIZE_OFFSET       18
 #define BMP_BPP_OFFSET        28
 #define BMP_RLE_OFFSET        30
-#define BMP_COLOR_OFFSET      54
+#define BMP_NCOLORS_OFFSET    46
+#define BMP_MASKS_OFFSET      54
 
-#define fill4B(a)	( ( 4 - ( (a) % 4 ) ) & 0x03)
+#define BMP_RGB               0
+#define BMP_BITFIELDS         3
+
+#define le16(p)	((p)[0] | ((p)[1] << 8))
+#define le32(p)	((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((unsigned int)(p)[3] << 24))
 
 struct color
 {
@@ -22,193 +30,245 @@ struct color
 	unsigned char blue;
 };
 
-int fh_bmp_id(char *name)
+/* one channel of a 16 or 32 bit pixel: lut[(pixel & mask) >> shift] */
+struct bmp_field
+{
+	unsigned int mask, shift;
+	unsigned char lut[256];
+};
+
+static int fh_bmp_id(const unsigned char *id, int len)
 {
-	int fd;
-	char id[2];
-	fd = open(name, O_RDONLY);
-	if(fd == -1) return(0);
-	read(fd, id, 2);
-	close(fd);
-	if(id[0]=='B' && id[1]=='M') return(1);
+	if(len >= 2 && id[0]=='B' && id[1]=='M') return(1);
 	return(0);
 }
 
-
-void fetch_pallete(int fd, struct color pallete[], int count)
+static void make_field(struct bmp_field *f, unsigned int mask)
 {
-	unsigned char buff[4];
-	int i;
+	unsigned int bits = 0, max, v;
 
-	lseek(fd, BMP_COLOR_OFFSET, SEEK_SET);
-	for (i=0; i<count; i++)
+	f->mask = mask;
+	f->shift = 0;
+	if(!mask)
+	{
+		memset(f->lut, 0, sizeof(f->lut));
+		return;
+	}
+	while(!(mask & 1))
+	{
+		mask >>= 1;
+		f->shift++;
+	}
+	while(mask & 1)
+	{
+		mask >>= 1;
+		bits++;
+	}
+	/* keep only the top 8 bits of wider channels */
+	if(bits > 8)
 	{
-		read(fd, buff, 4);
-		pallete[i].red = buff[2];
-		pallete[i].green = buff[1];
-		pallete[i].blue = buff[0];
+		f->shift += bits - 8;
+		bits = 8;
 	}
-	return;
+	max = (1 << bits) - 1;
+	for(v = 0; v <= max; v++)
+		f->lut[v] = (v * 255 + max / 2) / max;
 }
 
+#define FIELD(f, p)	((f)->lut[((p) & (f)->mask) >> (f)->shift])
 
-int fh_bmp_load(char *name, unsigned char *buffer, unsigned char **alpha, int x,int y)
+/*
+ * Into buffer and *alpha, or with row set a row at a time through
+ * one-row buffers.
+ */
+static int bmp_decode(FILE *fh, unsigned char *buffer, unsigned char **alpha, int x, int y,
+	fh_row_fn put, void *ctx)
 {
-	int fd, bpp, raster, i, j, k, skip;
-	unsigned char buff[4];
-	unsigned char *wr_buffer = buffer + x*(y-1)*3;
+	int fd = fileno(fh), bpp, compression, raster, hdr, ncolors, rowbytes, i, j;
+	int mapped = 1, height, ret = FH_ERROR_FORMAT;
+	unsigned char *map, *row, *wr_buffer, *abuf = NULL, *arow = NULL, *rowbuf = NULL;
+	unsigned char expand[256][8];
 	struct color pallete[256];
+	struct bmp_field field[4];
+	const struct fb_converter *swap = fb_get_converter(24);
+	struct stat st;
+	size_t size;
 
-	fd = open(name, O_RDONLY);
-	if (fd == -1) {
-		return(FH_ERROR_FILE);
+	if (fstat(fd, &st) == -1 || st.st_size < BMP_MASKS_OFFSET)
+		return(FH_ERROR_FORMAT);
+	size = st.st_size;
+
+	/* the whole file at once; read it in if it cannot be mapped */
+	map = (unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		mapped = 0;
+		map = (unsigned char*)malloc(size);
+		if (!map || pread(fd, map, size, 0) != (ssize_t)size) {
+			free(map);
+			return(FH_ERROR_FILE);
+		}
 	}
 
-	if (lseek(fd, BMP_TORASTER_OFFSET, SEEK_SET) == -1) {
-		return(FH_ERROR_FORMAT);
+	raster = le32(map + BMP_TORASTER_OFFSET);
+	hdr = le32(map + BMP_HEADER_OFFSET);
+	height = (int)le32(map + BMP_SIZE_OFFSET + 4);
+	bpp = le16(map + BMP_BPP_OFFSET);
+	compression = le32(map + BMP_RLE_OFFSET);
+	ncolors = le32(map + BMP_NCOLORS_OFFSET);
+
+	if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 16 && bpp != 24 && bpp != 32)
+		goto out;
+	rowbytes = ((x * bpp + 31) / 32) * 4;
+	if (raster < 0 || (size_t)raster > size || (size_t)rowbytes * y > size - raster)
+		goto out;
+	if (compression != BMP_RGB && !(compression == BMP_BITFIELDS && (bpp == 16 || bpp == 32)))
+		goto out;
+
+	if (bpp <= 8) {
+		unsigned char *pal;
+
+		if (ncolors <= 0 || ncolors > (1 << bpp))
+			ncolors = 1 << bpp;
+		/* the palette follows the info header, whose size is in the file */
+		if (hdr < 12 || (size_t)BMP_HEADER_OFFSET + hdr + (size_t)ncolors * 4 > size)
+			goto out;
+		pal = map + BMP_HEADER_OFFSET + hdr;
+		memset(pallete, 0, sizeof(pallete));
+		for (i = 0; i < ncolors; i++) {
+			pallete[i].red = pal[4*i+2];
+			pallete[i].green = pal[4*i+1];
+			pallete[i].blue = pal[4*i];
+		}
+		/* the palette indices packed in each possible byte */
+		for (i = 0; i < 256; i++)
+			for (j = 0; j < 8 / bpp; j++)
+				expand[i][j] = (i << (j * bpp) & 0xff) >> (8 - bpp);
+	} else if (bpp == 16 || bpp == 32) {
+		unsigned int masks[4] = { 0, 0, 0, 0 };
+
+		if (compression == BMP_BITFIELDS) {
+			if (BMP_MASKS_OFFSET + 12 > size)
+				goto out;
+			masks[0] = le32(map + BMP_MASKS_OFFSET);
+			masks[1] = le32(map + BMP_MASKS_OFFSET + 4);
+			masks[2] = le32(map + BMP_MASKS_OFFSET + 8);
+			/* V3 and later headers carry an alpha mask as well */
+			if (hdr >= 56 && BMP_MASKS_OFFSET + 16 <= size)
+				masks[3] = le32(map + BMP_MASKS_OFFSET + 12);
+		} else if (bpp == 16) {
+			masks[0] = 0x7c00; masks[1] = 0x03e0; masks[2] = 0x001f;
+		} else {
+			masks[0] = 0xff0000; masks[1] = 0x00ff00; masks[2] = 0x0000ff;
+		}
+		for (i = 0; i < 4; i++)
+			make_field(&field[i], masks[i]);
+
+		/* many writers leave the alpha byte zero: treat that as opaque */
+		for (i = 0; bpp == 32 && masks[3] && !abuf && i < y; i++) {
+			row = map + raster + (size_t)rowbytes * i;
+			for (j = 0; j < x && !(le32(row + 4*j) & masks[3]); j++)
+				;
+			if (j < x && !(abuf = (unsigned char*)malloc(put ? x : (size_t)x * y))) {
+				ret = FH_ERROR_FILE;
+				goto out;
+			}
+		}
 	}
-	read(fd, buff, 4);
-	raster = buff[0] + (buff[1]<<8) + (buff[2]<<16) + (buff[3]<<24);
 
-	if (lseek(fd, BMP_BPP_OFFSET, SEEK_SET) == -1) {
-		return(FH_ERROR_FORMAT);
+	if (put && !(buffer = rowbuf = (unsigned char*)malloc(x * 3))) {
+		ret = FH_ERROR_FILE;
+		goto out;
 	}
-	read(fd, buff, 2);
-	bpp = buff[0] + (buff[1]<<8);
 
-	switch (bpp)
-	{
-		case 1: /* monochrome */
-			skip = fill4B(x/8+(x%8?1:0));
-			lseek(fd, raster, SEEK_SET);
-			for (i=0; i<y; i++) {
-				for (j=0; j<x/8; j++) {
-					read(fd, buff, 1);
-					for (k=0; k<8; k++) {
-						if (buff[0] & 0x80) {
-							*wr_buffer++ = 0xff;
-							*wr_buffer++ = 0xff;
-							*wr_buffer++ = 0xff;
-						} else {
-							*wr_buffer++ = 0x00;
-							*wr_buffer++ = 0x00;
-							*wr_buffer++ = 0x00;
-						}
-						buff[0] = buff[0]<<1;
-					}
+	for (i = 0; i < y; i++) {
+		/* rows are stored bottom up unless the height is negative */
+		row = map + raster + (size_t)rowbytes * (height < 0 ? i : y - 1 - i);
+		wr_buffer = put ? rowbuf : buffer + (size_t)x * 3 * i;
+		arow = !abuf ? NULL : put ? abuf : abuf + (size_t)x * i;
 
-				}
-				if (x%8) {
-					read(fd, buff, 1);
-					for (k=0; k<x%8; k++) {
-						if (buff[0] & 0x80) {
-							*wr_buffer++ = 0xff;
-							*wr_buffer++ = 0xff;
-							*wr_buffer++ = 0xff;
-						} else {
-							*wr_buffer++ = 0x00;
-							*wr_buffer++ = 0x00;
-							*wr_buffer++ = 0x00;
-						}
-						buff[0] = buff[0]<<1;
-					}
+		switch (bpp)
+		{
+			case 1: /* monochrome */
+			case 4: /* 4bit palletized */
+			case 8: /* 8bit palletized */
+			{
+				int per = 8 / bpp;
 
+				for (j = 0; j < x; j++) {
+					struct color *c = &pallete[expand[row[j / per]][j % per]];
+					*wr_buffer++ = c->red;
+					*wr_buffer++ = c->green;
+					*wr_buffer++ = c->blue;
 				}
-				if (skip) {
-					read(fd, buff, skip);
-				}
-				wr_buffer -= x*6; /* backoff 2 lines - x*2 *3 */
-			}
-			break;
-		case 4: /* 4bit palletized */
-			skip = fill4B(x/2+x%2);
-			fetch_pallete(fd, pallete, 16);
-			lseek(fd, raster, SEEK_SET);
-			for (i=0; i<y; i++) {
-				for (j=0; j<x/2; j++) {
-					read(fd, buff, 1);
-					buff[1] = buff[0]>>4;
-					buff[2] = buff[0] & 0x0f;
-					*wr_buffer++ = pallete[buff[1]].red;
-					*wr_buffer++ = pallete[buff[1]].green;
-					*wr_buffer++ = pallete[buff[1]].blue;
-					*wr_buffer++ = pallete[buff[2]].red;
-					*wr_buffer++ = pallete[buff[2]].green;
-					*wr_buffer++ = pallete[buff[2]].blue;
-				}
-				if (x%2) {
-					read(fd, buff, 1);
-					buff[1] = buff[0]>>4;
-					*wr_buffer++ = pallete[buff[1]].red;
-					*wr_buffer++ = pallete[buff[1]].green;
-					*wr_buffer++ = pallete[buff[1]].blue;
-				}
-				if (skip) {
-					read(fd, buff, skip);
-				}
-				wr_buffer -= x*6; /* backoff 2 lines - x*2 *3 */
-			}
-			break;
-		case 8: /* 8bit palletized */
-			skip = fill4B(x);
-			fetch_pallete(fd, pallete, 256);
-			lseek(fd, raster, SEEK_SET);
-			for (i=0; i<y; i++) {
-				for (j=0; j<x; j++) {
-					read(fd, buff, 1);
-					*wr_buffer++ = pallete[buff[0]].red;
-					*wr_buffer++ = pallete[buff[0]].green;
-					*wr_buffer++ = pallete[buff[0]].blue;
-				}
-				if (skip) {
-					read(fd, buff, skip);
-				}
-				wr_buffer -= x*6; /* backoff 2 lines - x*2 *3 */
+				break;
 			}
-			break;
-		case 16: /* 16bit RGB */
-			return(FH_ERROR_FORMAT);
-			break;
-		case 24: /* 24bit RGB */
-			skip = fill4B(x*3);
-			lseek(fd, raster, SEEK_SET);
-			for (i=0; i<y; i++) {
-				for (j=0; j<x; j++) {
-					read(fd, buff, 3);
-					*wr_buffer++ = buff[2];
-					*wr_buffer++ = buff[1];
-					*wr_buffer++ = buff[0];
+			case 16: /* 16bit RGB */
+				for (j = 0; j < x; j++) {
+					unsigned int p = le16(row + 2*j);
+					*wr_buffer++ = FIELD(&field[0], p);
+					*wr_buffer++ = FIELD(&field[1], p);
+					*wr_buffer++ = FIELD(&field[2], p);
 				}
-				if (skip) {
-					read(fd, buff, skip);
+				break;
+			case 24: /* 24bit RGB */
+				swap->convert(wr_buffer, row, x);
+				break;
+			case 32: /* 32bit RGB, maybe with alpha */
+				for (j = 0; j < x; j++) {
+					unsigned int p = le32(row + 4*j);
+					*wr_buffer++ = FIELD(&field[0], p);
+					*wr_buffer++ = FIELD(&field[1], p);
+					*wr_buffer++ = FIELD(&field[2], p);
+					if (arow)
+						arow[j] = FIELD(&field[3], p);
 				}
-				wr_buffer -= x*6; /* backoff 2 lines - x*2 *3 */
-			}
-			break;
-		default:
-			return(FH_ERROR_FORMAT);
+				break;
+		}
+		if (put && put(ctx, i, rowbuf, arow)) {
+			ret = FH_ERROR_FILE;
+			goto out;
+		}
 	}
 
-	close(fd);
-	return(FH_ERROR_OK);
+	if (!put) {
+		*alpha = abuf;
+		abuf = NULL;
+	}
+	ret = FH_ERROR_OK;
+out:
+	free(abuf);
+	free(rowbuf);
+	if (mapped)
+		munmap(map, size);
+	else
+		free(map);
+	return(ret);
 }
 
-int fh_bmp_getsize(char *name,int *x,int *y)
+/* straight from the mapped file, too quick to be worth reporting progress */
+static int fh_bmp_load(FILE *fh, unsigned char *buffer, unsigned char **alpha, int x, int y,
+	fh_progress_fn progress, void *ctx)
 {
-	int fd;
-	unsigned char size[4];
+	return bmp_decode(fh, buffer, alpha, x, y, NULL, NULL);
+}
 
-	fd = open(name, O_RDONLY);
-	if (fd == -1) return(FH_ERROR_FILE);
-	if (lseek(fd, BMP_SIZE_OFFSET, SEEK_SET) == -1) return(FH_ERROR_FORMAT);
+static int fh_bmp_load_rows(FILE *fh, int x, int y, fh_row_fn row, void *ctx)
+{
+	return bmp_decode(fh, NULL, NULL, x, y, row, ctx);
+}
 
-	read(fd, size, 4);
-	*x = size[0] + (size[1]<<8) + (size[2]<<16) + (size[3]<<24);
-	read(fd, size, 4);
-	*y = size[0] + (size[1]<<8) + (size[2]<<16) + (size[3]<<24);
+static int fh_bmp_getsize(FILE *fh, const unsigned char *hdr, int len, int *x, int *y, int wanted_x, int wanted_y)
+{
+	int h;
 
-	close(fd);
+	if (len < BMP_SIZE_OFFSET + 8)
+		return(FH_ERROR_FORMAT);
+	*x = le32(hdr + BMP_SIZE_OFFSET);
+	h = (int)le32(hdr + BMP_SIZE_OFFSET + 4);
+	*y = h < 0 ? -h : h;
+	if (*x <= 0 || *y <= 0) return(FH_ERROR_FORMAT);
 	return(FH_ERROR_OK);
 }
-#endif /*FBV_SUPPORT_BMP*/
 
+const struct fh_loader fh_bmp_loader = { "BMP", fh_bmp_id, fh_bmp_getsize, fh_bmp_load, fh_bmp_load_rows };
+#endif /*FBV_SUPPORT_BMP*/
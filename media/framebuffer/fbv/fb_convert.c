@@ -0,0 +1,625 @@
+/*
+ * fb_convert.c
+ *
+ * RGB888 to framebuffer pixel format row converters, with SSSE3/AVX2
+ * and NEON versions of the 16, 24 and 32 bpp paths picked at runtime,
+ * and the same for alpha blending and for splitting decoded RGBA.
+ * The scalar versions are the reference: every vector kernel must give
+ * bit-exact the same output (see tests/convert_test.c).
+ */
+
+#include "fbv.h"
+
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FBV_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define FBV_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+inline static unsigned char make8color(unsigned char r, unsigned char g, unsigned char b)
+{
+	return (
+	(((r >> 5) & 7) << 5) |
+	(((g >> 5) & 7) << 2) |
+	 ((b >> 6) & 3)	   );
+}
+
+inline static unsigned short make15color(unsigned char r, unsigned char g, unsigned char b)
+{
+	return (
+	(((r >> 3) & 31) << 10) |
+	(((g >> 3) & 31) << 5)  |
+	 ((b >> 3) & 31)		);
+}
+
+inline static unsigned short make16color(unsigned char r, unsigned char g, unsigned char b)
+{
+	return (
+	(((r >> 3) & 31) << 11) |
+	(((g >> 2) & 63) << 5)  |
+	 ((b >> 3) & 31)		);
+}
+
+static void convert8_c(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int8_t *d = (u_int8_t *)dst;
+	unsigned long i;
+
+	for(i = 0; i < count; i++, rgb += 3)
+		d[i] = make8color(rgb[0], rgb[1], rgb[2]);
+}
+
+static void convert15_c(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int16_t *d = (u_int16_t *)dst;
+	unsigned long i;
+
+	for(i = 0; i < count; i++, rgb += 3)
+		d[i] = make15color(rgb[0], rgb[1], rgb[2]);
+}
+
+static void convert16_c(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int16_t *d = (u_int16_t *)dst;
+	unsigned long i;
+
+	for(i = 0; i < count; i++, rgb += 3)
+		d[i] = make16color(rgb[0], rgb[1], rgb[2]);
+}
+
+static void convert24_c(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int8_t *d = (u_int8_t *)dst;
+	unsigned long i;
+
+	/* Big endian framebuffer. */
+	for(i = 0; i < 3 * count; i += 3)
+	{
+		d[i] = rgb[i+2];
+		d[i+1] = rgb[i+1];
+		d[i+2] = rgb[i];
+	}
+}
+
+static void convert32_c(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int32_t *d = (u_int32_t *)dst;
+	unsigned long i;
+
+	for(i = 0; i < count; i++, rgb += 3)
+		d[i] = ((rgb[0] << 16) & 0xFF0000) |
+			((rgb[1] << 8) & 0xFF00) |
+			(rgb[2] & 0xFF);
+}
+
+static int cpu_any(void)
+{
+	return 1;
+}
+
+#ifdef FBV_CONVERT_X86
+
+#define X (-128)	/* pshufb: zero this byte */
+
+static int cpu_ssse3(void)
+{
+	return __builtin_cpu_supports("ssse3");
+}
+
+static int cpu_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+/* 8 pixels: rg lanes hold (g, r), b lanes hold (b, 0); see pack565() */
+static const signed char shuf_rg_lo[16] = { 1, 0,  4, 3,  7, 6, 10, 9, 13,12,  X, X,  X, X,  X, X };
+static const signed char shuf_rg_hi[16] = { X, X,  X, X,  X, X,  X, X,  X, X,  8, 7, 11,10, 14,13 };
+static const signed char shuf_b_lo[16]  = { 2, X,  5, X,  8, X, 11, X, 14, X,  X, X,  X, X,  X, X };
+static const signed char shuf_b_hi[16]  = { X, X,  X, X,  X, X,  X, X,  X, X,  9, X, 12, X, 15, X };
+/* 4 pixels RGB -> BGRX */
+static const signed char shuf_xrgb[16]  = { 2, 1, 0, X,  5, 4, 3, X,  8, 7, 6, X, 11,10, 9, X };
+/* 5 pixels RGB -> BGR, the 16th byte is rewritten by the next block */
+static const signed char shuf_bgr[16]   = { 2, 1, 0,  5, 4, 3,  8, 7, 6, 11,10, 9, 14,13,12, 15 };
+
+__attribute__((target("ssse3")))
+static inline __m128i pack565_ssse3(__m128i lo, __m128i hi)
+{
+	/* lo holds bytes 0..15 of 8 pixels, hi bytes 8..23 */
+	__m128i rg = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_loadu_si128((const __m128i *)shuf_rg_lo)),
+				  _mm_shuffle_epi8(hi, _mm_loadu_si128((const __m128i *)shuf_rg_hi)));
+	__m128i b = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_loadu_si128((const __m128i *)shuf_b_lo)),
+				 _mm_shuffle_epi8(hi, _mm_loadu_si128((const __m128i *)shuf_b_hi)));
+
+	return _mm_or_si128(_mm_or_si128(
+		_mm_and_si128(rg, _mm_set1_epi16((short)0xF800)),
+		_mm_slli_epi16(_mm_and_si128(rg, _mm_set1_epi16(0x00FC)), 3)),
+		_mm_srli_epi16(b, 3));
+}
+
+__attribute__((target("ssse3")))
+static void convert16_ssse3(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int16_t *d = (u_int16_t *)dst;
+	unsigned long i;
+
+	for(i = 0; i + 8 <= count; i += 8, rgb += 24)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)rgb);
+		__m128i hi = _mm_loadu_si128((const __m128i *)(rgb + 8));
+		_mm_storeu_si128((__m128i *)(d + i), pack565_ssse3(lo, hi));
+	}
+	convert16_c(d + i, rgb, count - i);
+}
+
+__attribute__((target("ssse3")))
+static void convert24_ssse3(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int8_t *d = (u_int8_t *)dst;
+	__m128i m = _mm_loadu_si128((const __m128i *)shuf_bgr);
+	unsigned long i;
+
+	/* 5 pixels per step, but each load and store touches 16 bytes */
+	for(i = 0; 3 * i + 16 <= 3 * count; i += 5, rgb += 15, d += 15)
+		_mm_storeu_si128((__m128i *)d, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)rgb), m));
+	convert24_c(d, rgb, count - i);
+}
+
+__attribute__((target("ssse3")))
+static void convert32_ssse3(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int32_t *d = (u_int32_t *)dst;
+	__m128i m = _mm_loadu_si128((const __m128i *)shuf_xrgb);
+	unsigned long i;
+
+	for(i = 0; i + 16 <= count; i += 16, rgb += 48)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)rgb);
+		__m128i b = _mm_loadu_si128((const __m128i *)(rgb + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(rgb + 32));
+
+		_mm_storeu_si128((__m128i *)(d + i), _mm_shuffle_epi8(a, m));
+		_mm_storeu_si128((__m128i *)(d + i + 4), _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), m));
+		_mm_storeu_si128((__m128i *)(d + i + 8), _mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), m));
+		_mm_storeu_si128((__m128i *)(d + i + 12), _mm_shuffle_epi8(_mm_srli_si128(c, 4), m));
+	}
+	convert32_c(d + i, rgb, count - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load2x128(const unsigned char *lo, const unsigned char *hi)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)lo)),
+				       _mm_loadu_si128((const __m128i *)hi), 1);
+}
+
+__attribute__((target("avx2")))
+static void convert16_avx2(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int16_t *d = (u_int16_t *)dst;
+	__m256i m_rg_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)shuf_rg_lo));
+	__m256i m_rg_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)shuf_rg_hi));
+	__m256i m_b_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)shuf_b_lo));
+	__m256i m_b_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)shuf_b_hi));
+	unsigned long i;
+
+	/* 16 pixels, 8 in each 128 bit lane */
+	for(i = 0; i + 16 <= count; i += 16, rgb += 48)
+	{
+		__m256i lo = load2x128(rgb, rgb + 24);
+		__m256i hi = load2x128(rgb + 8, rgb + 32);
+		__m256i rg = _mm256_or_si256(_mm256_shuffle_epi8(lo, m_rg_lo), _mm256_shuffle_epi8(hi, m_rg_hi));
+		__m256i b = _mm256_or_si256(_mm256_shuffle_epi8(lo, m_b_lo), _mm256_shuffle_epi8(hi, m_b_hi));
+		__m256i p = _mm256_or_si256(_mm256_or_si256(
+			_mm256_and_si256(rg, _mm256_set1_epi16((short)0xF800)),
+			_mm256_slli_epi16(_mm256_and_si256(rg, _mm256_set1_epi16(0x00FC)), 3)),
+			_mm256_srli_epi16(b, 3));
+
+		_mm256_storeu_si256((__m256i *)(d + i), p);
+	}
+	convert16_c(d + i, rgb, count - i);
+}
+
+__attribute__((target("avx2")))
+static void convert32_avx2(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int32_t *d = (u_int32_t *)dst;
+	__m256i m = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)shuf_xrgb));
+	unsigned long i;
+
+	/* the last 16 byte load reads 4 bytes past the 16 pixels */
+	for(i = 0; i + 18 <= count; i += 16, rgb += 48)
+	{
+		_mm256_storeu_si256((__m256i *)(d + i), _mm256_shuffle_epi8(load2x128(rgb, rgb + 12), m));
+		_mm256_storeu_si256((__m256i *)(d + i + 8), _mm256_shuffle_epi8(load2x128(rgb + 24, rgb + 36), m));
+	}
+	convert32_c(d + i, rgb, count - i);
+}
+
+#undef X
+#endif /* FBV_CONVERT_X86 */
+
+#ifdef FBV_CONVERT_NEON
+
+static void convert16_neon(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int16_t *d = (u_int16_t *)dst;
+	unsigned long i;
+
+	for(i = 0; i + 8 <= count; i += 8, rgb += 24)
+	{
+		uint8x8x3_t p = vld3_u8(rgb);
+		uint16x8_t v = vshll_n_u8(p.val[0], 8);
+
+		v = vsriq_n_u16(v, vshll_n_u8(p.val[1], 8), 5);
+		v = vsriq_n_u16(v, vshll_n_u8(p.val[2], 8), 11);
+		vst1q_u16(d + i, v);
+	}
+	convert16_c(d + i, rgb, count - i);
+}
+
+static void convert24_neon(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int8_t *d = (u_int8_t *)dst;
+	unsigned long i;
+
+	for(i = 0; i + 16 <= count; i += 16, rgb += 48, d += 48)
+	{
+		uint8x16x3_t p = vld3q_u8(rgb);
+		uint8x16_t t = p.val[0];
+
+		p.val[0] = p.val[2];
+		p.val[2] = t;
+		vst3q_u8(d, p);
+	}
+	convert24_c(d, rgb, count - i);
+}
+
+static void convert32_neon(void *dst, const unsigned char *rgb, unsigned long count)
+{
+	u_int32_t *d = (u_int32_t *)dst;
+	unsigned long i;
+
+	for(i = 0; i + 16 <= count; i += 16, rgb += 48)
+	{
+		uint8x16x3_t p = vld3q_u8(rgb);
+		uint8x16x4_t q;
+
+		q.val[0] = p.val[2];
+		q.val[1] = p.val[1];
+		q.val[2] = p.val[0];
+		q.val[3] = vdupq_n_u8(0);
+		vst4q_u8((uint8_t *)(d + i), q);
+	}
+	convert32_c(d + i, rgb, count - i);
+}
+
+#endif /* FBV_CONVERT_NEON */
+
+/* best first; the scalar entry of every bpp ends its group */
+const struct fb_converter fb_converters[] =
+{
+#ifdef FBV_CONVERT_X86
+	{ "avx2",  16, 2, convert16_avx2,  cpu_avx2 },
+	{ "ssse3", 16, 2, convert16_ssse3, cpu_ssse3 },
+	{ "ssse3", 24, 3, convert24_ssse3, cpu_ssse3 },
+	{ "avx2",  32, 4, convert32_avx2,  cpu_avx2 },
+	{ "ssse3", 32, 4, convert32_ssse3, cpu_ssse3 },
+#endif
+#ifdef FBV_CONVERT_NEON
+	{ "neon",  16, 2, convert16_neon,  cpu_any },
+	{ "neon",  24, 3, convert24_neon,  cpu_any },
+	{ "neon",  32, 4, convert32_neon,  cpu_any },
+#endif
+	{ "c",      8, 1, convert8_c,      cpu_any },
+	{ "c",     15, 2, convert15_c,     cpu_any },
+	{ "c",     16, 2, convert16_c,     cpu_any },
+	{ "c",     24, 3, convert24_c,     cpu_any },
+	{ "c",     32, 4, convert32_c,     cpu_any },
+	{ NULL,     0, 0, NULL,            NULL }
+};
+
+const struct fb_converter *fb_get_converter(int bpp)
+{
+	static const struct fb_converter *cache[33];
+	const struct fb_converter *c;
+
+	if(bpp < 0 || bpp > 32)
+		return NULL;
+	if(cache[bpp])
+		return cache[bpp];
+
+	for(c = fb_converters; c->name; c++)
+		if(c->bpp == bpp && c->supported())
+			return cache[bpp] = c;
+	return NULL;
+}
+
+/*
+ * Framebuffer pixels back to RGB888, used to save what is under an
+ * image with alpha. Expanding by bit replication makes unpack followed
+ * by the scalar converter give back the same pixel.
+ */
+void fb_unpack_row(int bpp, unsigned char *rgb, const void *src, unsigned long count)
+{
+	const u_int8_t *c = (const u_int8_t *)src;
+	const u_int16_t *s = (const u_int16_t *)src;
+	const u_int32_t *l = (const u_int32_t *)src;
+	unsigned long i;
+	unsigned int r, g, b;
+
+	for(i = 0; i < count; i++, rgb += 3)
+	{
+		switch(bpp)
+		{
+		case 8:
+			r = c[i] >> 5; g = (c[i] >> 2) & 7; b = c[i] & 3;
+			rgb[0] = (r << 5) | (r << 2) | (r >> 1);
+			rgb[1] = (g << 5) | (g << 2) | (g >> 1);
+			rgb[2] = b * 0x55;
+			break;
+		case 15:
+			r = (s[i] >> 10) & 31; g = (s[i] >> 5) & 31; b = s[i] & 31;
+			rgb[0] = (r << 3) | (r >> 2);
+			rgb[1] = (g << 3) | (g >> 2);
+			rgb[2] = (b << 3) | (b >> 2);
+			break;
+		case 16:
+			r = s[i] >> 11; g = (s[i] >> 5) & 63; b = s[i] & 31;
+			rgb[0] = (r << 3) | (r >> 2);
+			rgb[1] = (g << 2) | (g >> 4);
+			rgb[2] = (b << 3) | (b >> 2);
+			break;
+		case 24:
+			rgb[0] = c[3*i+2];
+			rgb[1] = c[3*i+1];
+			rgb[2] = c[3*i];
+			break;
+		case 32:
+			rgb[0] = l[i] >> 16;
+			rgb[1] = l[i] >> 8;
+			rgb[2] = l[i];
+			break;
+		default:
+			rgb[0] = rgb[1] = rgb[2] = 0;
+		}
+	}
+}
+
+/*
+ * dst = src over dst, in RGB888 with one alpha byte per pixel. The
+ * division by 255 is rounded exactly the same way in every kernel:
+ * t = s * a + d * (255 - a) + 128, (t + (t >> 8)) >> 8.
+ */
+static void blend_c(unsigned char *dst, const unsigned char *src, const unsigned char *alpha, unsigned long count)
+{
+	unsigned long i;
+	unsigned int a, t;
+
+	for(i = 0; i < 3 * count; i++)
+	{
+		a = alpha[i / 3];
+		t = src[i] * a + dst[i] * (255 - a) + 128;
+		dst[i] = (t + (t >> 8)) >> 8;
+	}
+}
+
+#ifdef FBV_CONVERT_X86
+
+#define X (-128)
+
+/* alpha of pixels 0..15 spread over the 48 bytes of their RGB */
+static const signed char shuf_a0[16] = { 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5 };
+static const signed char shuf_a1[16] = { 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,10,10 };
+static const signed char shuf_a2[16] = {10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15 };
+
+__attribute__((target("ssse3")))
+static inline __m128i blend16_ssse3(__m128i s, __m128i d, __m128i a)
+{
+	__m128i z = _mm_setzero_si128(), ff = _mm_set1_epi16(255), r = _mm_set1_epi16(128);
+	__m128i al = _mm_unpacklo_epi8(a, z), ah = _mm_unpackhi_epi8(a, z);
+	__m128i lo = _mm_add_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(_mm_unpacklo_epi8(s, z), al),
+		_mm_mullo_epi16(_mm_unpacklo_epi8(d, z), _mm_sub_epi16(ff, al))), r);
+	__m128i hi = _mm_add_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(_mm_unpackhi_epi8(s, z), ah),
+		_mm_mullo_epi16(_mm_unpackhi_epi8(d, z), _mm_sub_epi16(ff, ah))), r);
+
+	lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+	hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+	return _mm_packus_epi16(lo, hi);
+}
+
+__attribute__((target("ssse3")))
+static void blend_ssse3(unsigned char *dst, const unsigned char *src, const unsigned char *alpha, unsigned long count)
+{
+	__m128i m0 = _mm_loadu_si128((const __m128i *)shuf_a0);
+	__m128i m1 = _mm_loadu_si128((const __m128i *)shuf_a1);
+	__m128i m2 = _mm_loadu_si128((const __m128i *)shuf_a2);
+	unsigned long i;
+
+	for(i = 0; i + 16 <= count; i += 16, src += 48, dst += 48, alpha += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)alpha);
+		int k;
+
+		for(k = 0; k < 3; k++)
+		{
+			__m128i ak = _mm_shuffle_epi8(a, k == 0 ? m0 : k == 1 ? m1 : m2);
+			__m128i s = _mm_loadu_si128((const __m128i *)(src + 16 * k));
+			__m128i d = _mm_loadu_si128((const __m128i *)(dst + 16 * k));
+
+			_mm_storeu_si128((__m128i *)(dst + 16 * k), blend16_ssse3(s, d, ak));
+		}
+	}
+	blend_c(dst, src, alpha, count - i);
+}
+
+#undef X
+#endif /* FBV_CONVERT_X86 */
+
+#ifdef FBV_CONVERT_NEON
+
+static inline uint8x16_t blend16_neon(uint8x16_t s, uint8x16_t d, uint8x16_t a)
+{
+	uint8x16_t na = vmvnq_u8(a);
+	uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(s), vget_low_u8(a)), vget_low_u8(d), vget_low_u8(na));
+	uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(s), vget_high_u8(a)), vget_high_u8(d), vget_high_u8(na));
+
+	/* (t + 128 + ((t + 128) >> 8)) >> 8 */
+	return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+			   vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+}
+
+static void blend_neon(unsigned char *dst, const unsigned char *src, const unsigned char *alpha, unsigned long count)
+{
+	unsigned long i;
+
+	for(i = 0; i + 16 <= count; i += 16, src += 48, dst += 48, alpha += 16)
+	{
+		uint8x16x3_t s = vld3q_u8(src);
+		uint8x16x3_t d = vld3q_u8(dst);
+		uint8x16_t a = vld1q_u8(alpha);
+
+		d.val[0] = blend16_neon(s.val[0], d.val[0], a);
+		d.val[1] = blend16_neon(s.val[1], d.val[1], a);
+		d.val[2] = blend16_neon(s.val[2], d.val[2], a);
+		vst3q_u8(dst, d);
+	}
+	blend_c(dst, src, alpha, count - i);
+}
+
+#endif /* FBV_CONVERT_NEON */
+
+const struct fb_blender fb_blenders[] =
+{
+#ifdef FBV_CONVERT_X86
+	{ "ssse3", blend_ssse3, cpu_ssse3 },
+#endif
+#ifdef FBV_CONVERT_NEON
+	{ "neon",  blend_neon,  cpu_any },
+#endif
+	{ "c",     blend_c,     cpu_any },
+	{ NULL,    NULL,        NULL }
+};
+
+fb_blend_fn fb_get_blender(void)
+{
+	static fb_blend_fn blend;
+	const struct fb_blender *b;
+
+	for(b = fb_blenders; !blend && b->name; b++)
+		if(b->supported())
+			blend = b->blend;
+	return blend;
+}
+
+/* RGBA to RGB888 and alpha */
+static void split_c(unsigned char *rgb, unsigned char *alpha, const unsigned char *rgba, unsigned long count)
+{
+	unsigned long i;
+
+	for(i = 0; i < count; i++, rgb += 3, rgba += 4)
+	{
+		rgb[0] = rgba[0];
+		rgb[1] = rgba[1];
+		rgb[2] = rgba[2];
+		alpha[i] = rgba[3];
+	}
+}
+
+#ifdef FBV_CONVERT_X86
+
+#define X (-128)
+
+/* rgb bytes 0..15, 16..31 and 32..47 of 16 pixels, from the 4 pixels in each of v0..v3 */
+static const signed char shuf_s00[16] = { 0, 1, 2, 4, 5, 6, 8, 9,10,12,13,14, X, X, X, X };
+static const signed char shuf_s01[16] = { X, X, X, X, X, X, X, X, X, X, X, X, 0, 1, 2, 4 };
+static const signed char shuf_s11[16] = { 5, 6, 8, 9,10,12,13,14, X, X, X, X, X, X, X, X };
+static const signed char shuf_s12[16] = { X, X, X, X, X, X, X, X, 0, 1, 2, 4, 5, 6, 8, 9 };
+static const signed char shuf_s22[16] = {10,12,13,14, X, X, X, X, X, X, X, X, X, X, X, X };
+static const signed char shuf_s23[16] = { X, X, X, X, 0, 1, 2, 4, 5, 6, 8, 9,10,12,13,14 };
+/* the 4 alpha bytes of a register first */
+static const signed char shuf_sa[16]  = { 3, 7,11,15, X, X, X, X, X, X, X, X, X, X, X, X };
+
+__attribute__((target("ssse3")))
+static void split_ssse3(unsigned char *rgb, unsigned char *alpha, const unsigned char *rgba, unsigned long count)
+{
+	__m128i ma = _mm_loadu_si128((const __m128i *)shuf_sa);
+	unsigned long i;
+
+	for(i = 0; i + 16 <= count; i += 16, rgb += 48, rgba += 64)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *)rgba);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(rgba + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(rgba + 32));
+		__m128i v3 = _mm_loadu_si128((const __m128i *)(rgba + 48));
+
+		_mm_storeu_si128((__m128i *)rgb, _mm_or_si128(
+			_mm_shuffle_epi8(v0, _mm_loadu_si128((const __m128i *)shuf_s00)),
+			_mm_shuffle_epi8(v1, _mm_loadu_si128((const __m128i *)shuf_s01))));
+		_mm_storeu_si128((__m128i *)(rgb + 16), _mm_or_si128(
+			_mm_shuffle_epi8(v1, _mm_loadu_si128((const __m128i *)shuf_s11)),
+			_mm_shuffle_epi8(v2, _mm_loadu_si128((const __m128i *)shuf_s12))));
+		_mm_storeu_si128((__m128i *)(rgb + 32), _mm_or_si128(
+			_mm_shuffle_epi8(v2, _mm_loadu_si128((const __m128i *)shuf_s22)),
+			_mm_shuffle_epi8(v3, _mm_loadu_si128((const __m128i *)shuf_s23))));
+		_mm_storeu_si128((__m128i *)(alpha + i), _mm_unpacklo_epi64(
+			_mm_unpacklo_epi32(_mm_shuffle_epi8(v0, ma), _mm_shuffle_epi8(v1, ma)),
+			_mm_unpacklo_epi32(_mm_shuffle_epi8(v2, ma), _mm_shuffle_epi8(v3, ma))));
+	}
+	split_c(rgb, alpha + i, rgba, count - i);
+}
+
+#undef X
+#endif /* FBV_CONVERT_X86 */
+
+#ifdef FBV_CONVERT_NEON
+
+static void split_neon(unsigned char *rgb, unsigned char *alpha, const unsigned char *rgba, unsigned long count)
+{
+	unsigned long i;
+
+	for(i = 0; i + 16 <= count; i += 16, rgb += 48, rgba += 64)
+	{
+		uint8x16x4_t p = vld4q_u8(rgba);
+		uint8x16x3_t q;
+
+		q.val[0] = p.val[0];
+		q.val[1] = p.val[1];
+		q.val[2] = p.val[2];
+		vst3q_u8(rgb, q);
+		vst1q_u8(alpha + i, p.val[3]);
+	}
+	split_c(rgb, alpha + i, rgba, count - i);
+}
+
+#endif /* FBV_CONVERT_NEON */
+
+const struct fb_splitter fb_splitters[] =
+{
+#ifdef FBV_CONVERT_X86
+	{ "ssse3", split_ssse3, cpu_ssse3 },
+#endif
+#ifdef FBV_CONVERT_NEON
+	{ "neon",  split_neon,  cpu_any },
+#endif
+	{ "c",     split_c,     cpu_any },
+	{ NULL,    NULL,        NULL }
+};
+
+fb_split_fn fb_get_splitter(void)
+{
+	static fb_split_fn split;
+	const struct fb_splitter *s;
+
+	for(s = fb_splitters; !split && s->name; s++)
+		if(s->supported())
+			split = s->split;
+	return split;
+}
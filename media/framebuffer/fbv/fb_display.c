@@ -13,15 +13,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "fbv.h"
+
 /* Public Use Functions:
  *
- * extern int fb_display(unsigned char *rgbbuff,
- *	 int x_size, int y_size,
+ * extern int fb_open(struct fb_context *fb, const char *name);
+ * extern void fb_close(struct fb_context *fb);
+ *
+ * extern int fb_display(struct fb_context *fb, struct image *i,
  *	 int x_pan, int y_pan,
  *	 int x_offs, int y_offs);
  *
- * extern int getCurrentRes(int *x,int *y);
+ * extern int fb_display_rows(struct fb_context *fb, struct image *i,
+ *	 int x_pan, int y_pan, int x_offs, int y_offs, int y0, int y1);
+ *
+ * extern void fb_image_invalidate(struct image *i);
+ *
+ * extern void fb_clear_screen(struct fb_context *fb);
+ * extern void fb_draw_rgb(struct fb_context *fb, const unsigned char *rgb,
+ *	 size_t stride, int width, int height, int x, int y);
  *
+ * extern int getCurrentRes(struct fb_context *fb, int *x, int *y);
+ *
+ * The device is opened and mapped once by fb_open(), through the backend
+ * its name picks: "mem:..." for a framebuffer in memory (fb_memory.c),
+ * anything else for an fbdev device, $FRAMEBUFFER or DEFAULT_FRAMEBUFFER
+ * when name is NULL. fb_display() converts
+ * the visible part of a new image directly into the framebuffer; from the
+ * second display on it caches the converted pixels, and the alpha runs
+ * always, so redrawing it at another pan position is only a blit. Images
+ * with alpha are blended over the screen as it was when the first of
+ * them was shown (black where fbv cleared it). If the virtual screen holds
+ * two pages, every frame is drawn off screen and shown with a pan at the
+ * next vertical blank, so nothing is ever seen half drawn. Call
+ * fb_image_invalidate() before the image's rgb or alpha buffers are
+ * changed or freed. fb_display_rows() paints some rows of an image that
+ * is not kept straight onto the visible page, while it is being decoded.
+ * fb_clear_screen() and fb_draw_rgb() draw on the visible page too, for
+ * screens made of many small pictures.
  */
 
 __u16 red[256], green[256], blue[256];
@@ -35,82 +64,402 @@ void closeFB(int fh);
 void getVarScreenInfo(int fh, struct fb_var_screeninfo *var);
 void setVarScreenInfo(int fh, struct fb_var_screeninfo *var);
 void getFixScreenInfo(int fh, struct fb_fix_screeninfo *fix);
-void set332map(int fh);
+void set332map(struct fb_context *fb);
+void get8map(struct fb_context *fb, struct fb_cmap *map);
+void set8map(struct fb_context *fb, struct fb_cmap *map);
 void* convertRGB2FB(int fh, unsigned char *rgbbuff, unsigned long count, int bpp, int *cpp);
-void blit2FB(int fh, unsigned char *fbbuff, unsigned char *alpha,
-	unsigned int pic_xs, unsigned int pic_ys,
+void blit2FB(struct fb_context *fb, struct image *img,
+	const struct fb_converter *conv,
 	unsigned int scr_xs, unsigned int scr_ys,
 	unsigned int xp, unsigned int yp,
-	unsigned int xoffs, unsigned int yoffs,
-	int cpp);
+	unsigned int xoffs, unsigned int yoffs, unsigned int page);
 
-int fb_display(unsigned char *rgbbuff, unsigned char * alpha,
-               unsigned int x_size, unsigned int y_size,
-               unsigned int x_pan, unsigned int y_pan,
-               unsigned int x_offs, unsigned int y_offs)
+/* the real thing: an fbdev device, its ioctls and its memory mapped */
+static int fbdev_open(struct fb_context *fb, const char *name)
 {
-	struct fb_var_screeninfo var;
-	struct fb_fix_screeninfo fix;
-	unsigned char *fbbuff = NULL;
-	int fh = -1, bp = 0;
-	unsigned int x_stride;
-
-	/* get the framebuffer device handle */
-	fh = openFB(NULL);
-	if(fh == -1)
+	fb->fh = openFB(name);
+	if(fb->fh == -1)
 		return -1;
 
 	/* read current video mode */
-	getVarScreenInfo(fh, &var);
-	getFixScreenInfo(fh, &fix);
+	getVarScreenInfo(fb->fh, &fb->var);
+	getFixScreenInfo(fb->fh, &fb->fix);
+
+	fb->mem_size = fb->fix.line_length * fb->var.yres_virtual;
+	fb->mem = (unsigned char*)mmap(NULL, fb->mem_size, PROT_WRITE | PROT_READ, MAP_SHARED, fb->fh, 0);
+	if(fb->mem == MAP_FAILED)
+	{
+		perror("mmap");
+		closeFB(fb->fh);
+		fb->fh = -1;
+		fb->mem = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void fbdev_close(struct fb_context *fb)
+{
+	munmap(fb->mem, fb->mem_size);
+	closeFB(fb->fh);
+}
+
+static int fbdev_pan(struct fb_context *fb, const struct fb_var_screeninfo *var)
+{
+	return ioctl(fb->fh, FBIOPAN_DISPLAY, var);
+}
+
+static int fbdev_wait_vsync(struct fb_context *fb)
+{
+	__u32 crtc = 0;
+
+	return ioctl(fb->fh, FBIO_WAITFORVSYNC, &crtc);
+}
+
+static int fbdev_get_cmap(struct fb_context *fb, struct fb_cmap *map)
+{
+	return ioctl(fb->fh, FBIOGETCMAP, map);
+}
+
+static int fbdev_set_cmap(struct fb_context *fb, struct fb_cmap *map)
+{
+	return ioctl(fb->fh, FBIOPUTCMAP, map);
+}
+
+const struct fb_backend fb_fbdev_backend =
+{
+	"fbdev", fbdev_open, fbdev_close, fbdev_pan, fbdev_wait_vsync, fbdev_get_cmap, fbdev_set_cmap
+};
+
+int fb_open(struct fb_context *fb, const char *name)
+{
+	memset(fb, 0, sizeof(*fb));
+	fb->fh = -1;
+
+	if(name == NULL)
+		name = getenv("FRAMEBUFFER");
+	if(name == NULL)
+		name = DEFAULT_FRAMEBUFFER;
+	fb->backend = strncmp(name, "mem:", 4) ? &fb_fbdev_backend : &fb_memory_backend;
+	if(fb->backend->open(fb, name))
+	{
+		fb->backend = NULL;
+		return -1;
+	}
+
+	/* room for a second page: draw off screen and flip */
+	fb->orig_yoffset = fb->var.yoffset;
+	fb->pages = fb->var.yres_virtual >= 2 * fb->var.yres ? 2 : 1;
+	fb->back = fb->var.yoffset >= fb->var.yres ? 0 : 1;
+	return 0;
+}
+
+void fb_close(struct fb_context *fb)
+{
+	if(fb->backend)
+	{
+		/* give the console back the page it was using */
+		if(fb->var.yoffset != fb->orig_yoffset)
+		{
+			fb->var.yoffset = fb->orig_yoffset;
+			fb->backend->pan(fb, &fb->var);
+		}
+		fb->backend->close(fb);
+	}
+	free(fb->bg);
+	fb->bg = NULL;
+	fb->mem = NULL;
+	fb->fh = -1;
+	fb->backend = NULL;
+}
+
+void fb_image_invalidate(struct image *i)
+{
+	free(i->fbbuff);
+	free(i->spans);
+	free(i->span_rows);
+	sampler_free(i->sampler);
+	i->fbbuff = NULL;
+	i->spans = NULL;
+	i->span_rows = NULL;
+	i->sampler = NULL;
+	i->shown = 0;
+}
+
+/*
+ * Split every alpha row once per image into runs of fully opaque and
+ * runs of partly transparent pixels. Fully transparent pixels are the
+ * gaps between the runs. Without the memory for them there are none,
+ * and every pixel is blended.
+ */
+static void build_alpha_spans(struct image *img)
+{
+	unsigned char *a = img->alpha;
+	int x, y, n = 0, size = img->height;
+	int from, opaque;
+	struct alpha_span *spans;
+
+	img->span_rows = (int*)malloc((img->height + 1) * sizeof(int));
+	img->spans = (struct alpha_span*)malloc(size * sizeof(struct alpha_span));
+	if(!img->span_rows || !img->spans)
+		goto fail;
+
+	for(y = 0; y < img->height; y++, a += img->width)
+	{
+		img->span_rows[y] = n;
+		for(x = 0; x < img->width; )
+		{
+			if(!a[x])
+			{
+				x++;
+				continue;
+			}
+			opaque = a[x] == 0xff;
+			for(from = x; x < img->width && a[x] && (a[x] == 0xff) == opaque; x++)
+				;
+			if(n == size)
+			{
+				size *= 2;
+				if(!(spans = (struct alpha_span*)realloc(img->spans, size * sizeof(struct alpha_span))))
+					goto fail;
+				img->spans = spans;
+			}
+			img->spans[n].start = from;
+			img->spans[n].len = x - from;
+			img->spans[n].opaque = opaque;
+			n++;
+		}
+	}
+	img->span_rows[y] = n;
+	return;
+fail:
+	free(img->spans);
+	free(img->span_rows);
+	img->spans = NULL;
+	img->span_rows = NULL;
+}
+
+/* whether a sampled image has alpha to blend, from memory or tiles */
+static int sampled_alpha(const struct image *img)
+{
+	return img->src_alpha || (img->src_tiles && img->src_tiles->alpha);
+}
+
+/*
+ * Keep a copy of the screen the first time an image with alpha is shown,
+ * so its transparent pixels can be blended against, and restored when
+ * the image is panned, without reading back what fbv drew itself.
+ * Without the memory for it images are drawn as if opaque.
+ */
+static void save_background(struct fb_context *fb)
+{
+	struct fb_var_screeninfo *var = &fb->var;
+	unsigned int y;
+
+	if(!(fb->bg = (unsigned char*)malloc(var->xres * var->yres * 3)))
+		return;
+	for(y = 0; y < var->yres; y++)
+		fb_unpack_row(var->bits_per_pixel, fb->bg + y * var->xres * 3,
+			fb->mem + (y + var->yoffset) * fb->fix.line_length, var->xres);
+}
+
+/* first line of the page to draw into: the back page, or the visible one */
+static unsigned int fb_draw_line(struct fb_context *fb)
+{
+	return fb->pages > 1 ? fb->back * fb->var.yres : fb->var.yoffset;
+}
+
+/*
+ * Show the back page, at the next vertical blank where the driver can
+ * wait for it. Without panning support fall back to drawing in place.
+ */
+static int fb_flip(struct fb_context *fb)
+{
+	struct fb_var_screeninfo var = fb->var;
+
+	var.xoffset = 0;
+	var.yoffset = fb->back * var.yres;
+	if(fb->vsync >= 0)
+		fb->vsync = fb->backend->wait_vsync(fb) ? -1 : 1;
+	if(fb->backend->pan(fb, &var))
+	{
+		fb->pages = 1;
+		return -1;
+	}
+	fb->var.xoffset = var.xoffset;
+	fb->var.yoffset = var.yoffset;
+	fb->back ^= 1;
+	return 0;
+}
+
+static const struct fb_converter *fb_converter(struct fb_context *fb)
+{
+	const struct fb_converter *conv = fb_get_converter(fb->var.bits_per_pixel);
 
-	x_stride = (fix.line_length * 8) / var.bits_per_pixel;
+	if(!conv)
+	{
+		fprintf(stderr, "Unsupported video mode! You've got: %dbpp\n", fb->var.bits_per_pixel);
+		exit(1);
+	}
+	return conv;
+}
+
+/* keep the window inside the image and the image on the screen */
+static void fb_correct(struct fb_context *fb, struct image *img,
+	unsigned int *x_pan, unsigned int *y_pan, unsigned int *x_offs, unsigned int *y_offs)
+{
+	struct fb_var_screeninfo *var = &fb->var;
+	unsigned int x_size = img->width, y_size = img->height;
 
 	/* correct panning */
-	if(x_pan > x_size - x_stride) x_pan = 0;
-	if(y_pan > y_size - var.yres) y_pan = 0;
+	if(*x_pan > x_size - var->xres) *x_pan = 0;
+	if(*y_pan > y_size - var->yres) *y_pan = 0;
 	/* correct offset */
-	if(x_offs + x_size > x_stride) x_offs = 0;
-	if(y_offs + y_size > var.yres) y_offs = 0;
+	if(*x_offs + x_size > var->xres) *x_offs = 0;
+	if(*y_offs + y_size > var->yres) *y_offs = 0;
+}
+
+/* a page not covered by the image starts black */
+static void fb_clear(struct fb_context *fb, unsigned int page)
+{
+	memset(fb->mem + page * fb->fix.line_length, 0, fb->var.yres * fb->fix.line_length);
+	if(fb->bg)
+		memset(fb->bg, 0, fb->var.xres * fb->var.yres * 3);
+}
+
+int fb_display(struct fb_context *fb, struct image *img,
+               unsigned int x_pan, unsigned int y_pan,
+               unsigned int x_offs, unsigned int y_offs)
+{
+	struct fb_var_screeninfo *var = &fb->var;
+	const struct fb_converter *conv = fb_converter(fb);
+	unsigned int x_size = img->width, y_size = img->height;
+
+	fb_correct(fb, img, &x_pan, &y_pan, &x_offs, &y_offs);
 
 	/* Check if not whole screen is covered */
 	if(x_offs || y_offs)
+		fb_clear(fb, fb_draw_line(fb));
+
+	/*
+	 * The first draw converts only the visible window, straight into
+	 * the framebuffer. Only an image shown again (panned) gets the
+	 * whole of it converted and kept, so panning is only a blit. If
+	 * there is no memory for that it is converted row by row as before.
+	 */
+	if(img->rgb && !img->fbbuff && img->shown)
+		img->fbbuff = (unsigned char*)convertRGB2FB(fb->fh, img->rgb, x_size * y_size, var->bits_per_pixel, &img->cpp);
+	if(img->alpha && !img->spans)
+		build_alpha_spans(img);
+	if(!img->rgb && !img->tiles && !img->sampler &&
+	   !(img->sampler = sampler_new(img->src_width, img->src_height, img->rotation, x_size, y_size, img->filter)))
 	{
-		unsigned char *fb;
-		int i;
-		fb = (unsigned char*)mmap(NULL, fix.line_length * var.yres_virtual, PROT_WRITE | PROT_READ, MAP_SHARED, fh, 0);
-
-		for(i = 0; i <  fix.line_length * var.yres_virtual; i++)
-		{
-			fb[i]=0;
-		}
+		fprintf(stderr, "Out of memory.\n");
+		return -1;
 	}
+	if((img->alpha || sampled_alpha(img) || (img->tiles && img->tiles->alpha)) && !fb->bg)
+		save_background(fb);
 
 	/* blit buffer 2 fb */
-	fbbuff = (unsigned char*)convertRGB2FB(fh, rgbbuff, x_size * y_size, var.bits_per_pixel, &bp);
-#if 0
-	blit2FB(fh, fbbuff, alpha, x_size, y_size, x_stride, var.yres, x_pan, y_pan, x_offs, y_offs, bp);
-#else
-	blit2FB(fh, fbbuff, alpha, x_size, y_size, x_stride, var.yres_virtual, x_pan, y_pan, x_offs, y_offs + var.yoffset, bp);
-#endif
-	free(fbbuff);
-
-	/* close device */
-	closeFB(fh);
+	blit2FB(fb, img, conv, var->xres, var->yres, x_pan, y_pan, x_offs, y_offs, fb_draw_line(fb));
+	img->shown++;
+
+	/* panning refused: draw again on the visible page */
+	if(fb->pages > 1 && fb_flip(fb))
+		return fb_display(fb, img, x_pan, y_pan, x_offs, y_offs);
 	return 0;
 }
 
-int getCurrentRes(int *x, int *y)
+/*
+ * Rows y0 .. y1 - 1 of an image that is not kept, in place on the
+ * visible page: there is no whole frame to flip to yet. The first call
+ * for an image clears around it.
+ */
+int fb_display_rows(struct fb_context *fb, struct image *img,
+               unsigned int x_pan, unsigned int y_pan,
+               unsigned int x_offs, unsigned int y_offs,
+               unsigned int y0, unsigned int y1)
 {
-	struct fb_var_screeninfo var;
-	int fh;
-	fh = openFB(NULL);
-	if(fh == -1)
+	struct fb_var_screeninfo *var = &fb->var;
+	const struct fb_converter *conv = fb_converter(fb);
+
+	fb_correct(fb, img, &x_pan, &y_pan, &x_offs, &y_offs);
+
+	if(!img->sampler &&
+	   !(img->sampler = sampler_new(img->src_width, img->src_height, img->rotation, img->width, img->height, img->filter)))
+	{
+		fprintf(stderr, "Out of memory.\n");
 		return -1;
-	getVarScreenInfo(fh, &var);
-	*x = var.xres;
-	*y = var.yres;
-	closeFB(fh);
+	}
+	if(sampled_alpha(img) && !fb->bg)
+		save_background(fb);
+	if(!img->shown++ && (x_offs || y_offs))
+		fb_clear(fb, var->yoffset);
+
+	if(y0 < y_pan)
+		y0 = y_pan;
+	if(y1 > y_pan + var->yres)
+		y1 = y_pan + var->yres;
+	if(y1 > (unsigned int)img->height)
+		y1 = img->height;
+	if(y0 < y1)
+		blit2FB(fb, img, conv, var->xres, y1 - y0, x_pan, y0, x_offs, y_offs + y0 - y_pan, var->yoffset);
+	return 0;
+}
+
+void fb_clear_screen(struct fb_context *fb)
+{
+	fb_clear(fb, fb->var.yoffset);
+}
+
+/*
+ * width x height RGB888 pixels whose rows are stride bytes apart (0 to
+ * repeat the first row), at x, y of the visible page, clipped to it.
+ */
+void fb_draw_rgb(struct fb_context *fb, const unsigned char *rgb, size_t stride,
+	int width, int height, int x, int y)
+{
+	struct fb_var_screeninfo *var = &fb->var;
+	const struct fb_converter *conv = fb_converter(fb);
+	unsigned int line = fb->fix.line_length;
+	unsigned char *fbptr;
+	int i;
+
+	if(x < 0)
+	{
+		rgb -= x * 3;
+		width += x;
+		x = 0;
+	}
+	if(y < 0)
+	{
+		rgb -= y * stride;
+		height += y;
+		y = 0;
+	}
+	if(x + width > (int)var->xres)
+		width = var->xres - x;
+	if(y + height > (int)var->yres)
+		height = var->yres - y;
+	if(width <= 0 || height <= 0)
+		return;
+
+	if(conv->cpp == 1)
+	{
+		get8map(fb, &map_back);
+		set332map(fb);
+	}
+	fbptr = fb->mem + (y + var->yoffset) * line + x * conv->cpp;
+	for(i = 0; i < height; i++, fbptr += line, rgb += stride)
+		conv->convert(fbptr, rgb, width);
+	if(conv->cpp == 1)
+		set8map(fb, &map_back);
+}
+
+int getCurrentRes(struct fb_context *fb, int *x, int *y)
+{
+	*x = fb->var.xres;
+	*y = fb->var.yres;
 	return 0;
 }
 
@@ -187,191 +536,321 @@ void make332map(struct fb_cmap *map)
 	}
 }
 
-void set8map(int fh, struct fb_cmap *map)
+void set8map(struct fb_context *fb, struct fb_cmap *map)
 {
-	if (ioctl(fh, FBIOPUTCMAP, map) < 0)
+	if (fb->backend->set_cmap(fb, map) < 0)
 	{
 		fprintf(stderr, "Error putting colormap");
 		exit(1);
 	}
 }
 
-void get8map(int fh, struct fb_cmap *map)
+void get8map(struct fb_context *fb, struct fb_cmap *map)
 {
-	if (ioctl(fh, FBIOGETCMAP, map) < 0)
+	if (fb->backend->get_cmap(fb, map) < 0)
 	{
 		fprintf(stderr, "Error getting colormap");
 		exit(1);
 	}
 }
 
-void set332map(int fh)
+void set332map(struct fb_context *fb)
 {
 	make332map(&map332);
-	set8map(fh, &map332);
+	set8map(fb, &map332);
 }
 
-void blit2FB(int fh, unsigned char *fbbuff, unsigned char *alpha,
-	unsigned int pic_xs, unsigned int pic_ys,
-	unsigned int scr_xs, unsigned int scr_ys,
-	unsigned int xp, unsigned int yp,
-	unsigned int xoffs, unsigned int yoffs,
-	int cpp)
+/* len pixels of image row y from column x, from the cache or the rgb */
+inline static void put_run(struct image *img, const struct fb_converter *conv,
+	unsigned char *dst, unsigned int x, unsigned int y, int len)
 {
-	int i, xc, yc;
-	unsigned char *fb;
-
-	unsigned char *fbptr;
-	unsigned char *imptr;
+	unsigned long offs = (unsigned long)y * img->width + x;
 
-	xc = (pic_xs > scr_xs) ? scr_xs : pic_xs;
-	yc = (pic_ys > scr_ys) ? scr_ys : pic_ys;
+	if(img->fbbuff)
+		memcpy(dst, img->fbbuff + offs * conv->cpp, len * conv->cpp);
+	else
+		conv->convert(dst, img->rgb + offs * 3, len);
+}
 
-	fb = (unsigned char*)mmap(NULL, scr_xs * scr_ys * cpp, PROT_WRITE | PROT_READ, MAP_SHARED, fh, 0);
+/*
+ * One row of an image with alpha: opaque runs are copied, partly
+ * transparent ones blended over the saved background in tmp, and the
+ * gaps get the background back.
+ */
+static void blit_alpha_row(struct image *img, const struct fb_converter *conv,
+	fb_blend_fn blend, unsigned char *fbptr, const unsigned char *bgptr,
+	unsigned char *tmp, unsigned int xp, unsigned int y, int xc)
+{
+	struct alpha_span *sp = img->spans + img->span_rows[y];
+	struct alpha_span *end = img->spans + img->span_rows[y + 1];
+	unsigned long offs;
+	int from, to, x = 0, cpp = conv->cpp;
 
-	if(fb == MAP_FAILED)
+	for(;; sp++)
 	{
-		perror("mmap");
-		return;
+		if(sp < end)
+		{
+			from = sp->start - (int)xp;
+			to = from + sp->len;
+			if(to <= 0)
+				continue;
+			if(from < 0) from = 0;
+			if(from > xc) from = xc;
+			if(to > xc) to = xc;
+		}
+		else
+			from = to = xc;
+
+		if(x < from)
+			conv->convert(fbptr + x * cpp, bgptr + x * 3, from - x);
+		if(from == xc)
+			break;
+
+		if(sp->opaque)
+			put_run(img, conv, fbptr + from * cpp, xp + from, y, to - from);
+		else
+		{
+			offs = (unsigned long)y * img->width + xp + from;
+			memcpy(tmp, bgptr + from * 3, (to - from) * 3);
+			blend(tmp, img->rgb + offs * 3, img->alpha + offs, to - from);
+			conv->convert(fbptr + from * cpp, tmp, to - from);
+		}
+		x = to;
 	}
+}
 
-	if(cpp == 1)
+/*
+ * The visible window of an image that is not kept: sample a band of
+ * rows at a time, then blend each row over the background if it has
+ * alpha, and convert it into the framebuffer. From tiles, the part of
+ * the level a band needs is read out of them first.
+ */
+#define SAMPLE_BAND	64
+
+/* the band's source from the tiles into *rgb and *alpha, grown as needed */
+static int read_source(struct image *img, int y0, int y1, int x0, int len,
+	unsigned char **rgb, unsigned char **alpha, size_t *size, int *sx, int *sy, int *width)
+{
+	struct tiles *t = img->src_tiles;
+	unsigned char *p;
+	int height;
+
+	sampler_source(img->sampler, y0, y1, x0, len, sx, sy, width, &height);
+	if((size_t)*width * height > *size)
 	{
-		get8map(fh, &map_back);
-		set332map(fh);
+		*size = (size_t)*width * height;
+		if(!(p = (unsigned char*)realloc(*rgb, *size * 3)))
+			goto oom;
+		*rgb = p;
+		if(t->alpha)
+		{
+			if(!(p = (unsigned char*)realloc(*alpha, *size)))
+				goto oom;
+			*alpha = p;
+		}
 	}
+	if(tiles_read(t, img->src_level, *sx, *sy, *width, height, *rgb, t->alpha ? *alpha : NULL))
+	{
+		perror("tile");
+		return -1;
+	}
+	return 0;
+oom:
+	fprintf(stderr, "Out of memory.\n");
+	return -1;
+}
 
-	fbptr = fb + (yoffs * scr_xs + xoffs) * cpp;
-	imptr = fbbuff + (yp * pic_xs + xp) * cpp;
+static void blit_sampled(struct fb_context *fb, struct image *img,
+	const struct fb_converter *conv, unsigned char *fbptr,
+	unsigned int scr_xs, unsigned int xp, unsigned int yp,
+	unsigned int xoffs, unsigned int yoffs, int xc, int yc)
+{
+	unsigned int line = fb->fix.line_length;
+	unsigned char *rgb, *alpha = NULL, *tmp = NULL, *bgptr = NULL;
+	const unsigned char *src_rgb = img->src_rgb, *src_alpha = img->src_alpha;
+	unsigned char *region = NULL, *region_alpha = NULL;
+	size_t region_size = 0;
+	fb_blend_fn blend = NULL;
+	int y, i, n, sx = 0, sy = 0, sw = img->src_width;
+	int blending = sampled_alpha(img) && fb->bg;
+
+	rgb = (unsigned char*)malloc((size_t)xc * 3 * SAMPLE_BAND);
+	if(blending)
+	{
+		blend = fb_get_blender();
+		alpha = (unsigned char*)malloc((size_t)xc * SAMPLE_BAND);
+		tmp = (unsigned char*)malloc((size_t)xc * 3);
+		bgptr = fb->bg + (yoffs * scr_xs + xoffs) * 3;
+	}
+	if(!rgb || (blending && (!alpha || !tmp)))
+	{
+		fprintf(stderr, "Out of memory.\n");
+		goto out;
+	}
 
-	if(alpha)
+	for(y = 0; y < yc; y += n)
 	{
-		unsigned char * alphaptr;
-		int from, to, x;
+		n = yc - y < SAMPLE_BAND ? yc - y : SAMPLE_BAND;
+		if(img->src_tiles)
+		{
+			if(read_source(img, yp + y, yp + y + n, xp, xc, &region, &region_alpha, &region_size, &sx, &sy, &sw))
+				goto out;
+			src_rgb = region;
+			src_alpha = region_alpha;
+		}
+		if(sampler_rows_from(img->sampler, src_rgb, sx, sy, sw, 3, yp + y, yp + y + n, xp, xc, rgb, xc * 3) ||
+		   (alpha && sampler_rows_from(img->sampler, src_alpha, sx, sy, sw, 1, yp + y, yp + y + n, xp, xc, alpha, xc)))
+		{
+			fprintf(stderr, "Out of memory.\n");
+			goto out;
+		}
+		for(i = 0; i < n; i++, fbptr += line)
+			if(alpha)
+			{
+				memcpy(tmp, bgptr, xc * 3);
+				blend(tmp, rgb + i * xc * 3, alpha + i * xc, xc);
+				conv->convert(fbptr, tmp, xc);
+				bgptr += scr_xs * 3;
+			}
+			else
+				conv->convert(fbptr, rgb + i * xc * 3, xc);
+	}
+out:
+	free(rgb);
+	free(alpha);
+	free(tmp);
+	free(region);
+	free(region_alpha);
+}
 
-		alphaptr = alpha + (yp  * pic_xs + xp);
+/* the visible window of a tiled image, a tile at a time */
+static void blit_tiled(struct fb_context *fb, struct image *img,
+	const struct fb_converter *conv, unsigned char *fbptr,
+	unsigned int scr_xs, unsigned int xp, unsigned int yp,
+	unsigned int xoffs, unsigned int yoffs, int xc, int yc)
+{
+	struct tiles *t = img->tiles;
+	unsigned int line = fb->fix.line_length;
+	unsigned char *tmp = NULL;
+	fb_blend_fn blend = NULL;
+	int x, y, w, h, i;
 
-		for(i = 0; i < yc; i++, fbptr += scr_xs * cpp, imptr += pic_xs * cpp, alphaptr += pic_xs)
+	if(t->alpha && fb->bg)
+	{
+		blend = fb_get_blender();
+		if(!(tmp = (unsigned char*)malloc(TILE_SIZE * 3)))
 		{
-			for(x = 0; x<xc; x++)
-			{
-				int v;
+			fprintf(stderr, "Out of memory.\n");
+			return;
+		}
+	}
 
-				from = to = -1;
-				for(v = x; v<xc; v++)
-				{
-					if(from == -1)
-					{
-						if(alphaptr[v] > 0x80) from = v;
-					}
-					else
-					{
-						if(alphaptr[v] < 0x80)
-						{
-							to = v;
-							break;
-						}
-					}
-				}
-				if(from == -1)
-					break;
+	for(y = 0; y < yc; y += h)
+	{
+		int ty = (yp + y) / TILE_SIZE, y0 = (yp + y) % TILE_SIZE;
 
-				if(to == -1) to = xc;
+		h = min(TILE_SIZE - y0, yc - y);
+		for(x = 0; x < xc; x += w)
+		{
+			int tx = (xp + x) / TILE_SIZE, x0 = (xp + x) % TILE_SIZE;
+			const unsigned char *tile = tiles_get(t, 0, tx, ty), *rgb, *alpha;
+			unsigned char *dst = fbptr + y * line + x * conv->cpp;
+			unsigned char *bgptr = tmp ? fb->bg + ((yoffs + y) * scr_xs + xoffs + x) * 3 : NULL;
 
-				memcpy(fbptr + (from * cpp), imptr + (from * cpp), (to - from - 1) * cpp);
-				x += to - from - 1;
+			w = min(TILE_SIZE - x0, xc - x);
+			if(!tile)
+			{
+				perror("tile");
+				goto out;
 			}
+			rgb = tile + (y0 * TILE_SIZE + x0) * 3;
+			alpha = tile + TILE_SIZE * TILE_SIZE * 3 + y0 * TILE_SIZE + x0;
+			for(i = 0; i < h; i++, dst += line, rgb += TILE_SIZE * 3, alpha += TILE_SIZE)
+				if(tmp)
+				{
+					memcpy(tmp, bgptr, w * 3);
+					blend(tmp, rgb, alpha, w);
+					conv->convert(dst, tmp, w);
+					bgptr += scr_xs * 3;
+				}
+				else
+					conv->convert(dst, rgb, w);
 		}
 	}
-	else
-		for(i = 0; i < yc; i++, fbptr += scr_xs * cpp, imptr += pic_xs * cpp)
-			memcpy(fbptr, imptr, xc * cpp);
-
-	if(cpp == 1)
-		set8map(fh, &map_back);
-
-	munmap(fb, scr_xs * scr_ys * cpp);
+out:
+	free(tmp);
 }
 
-inline static unsigned char make8color(unsigned char r, unsigned char g, unsigned char b)
+void blit2FB(struct fb_context *fb, struct image *img,
+	const struct fb_converter *conv,
+	unsigned int scr_xs, unsigned int scr_ys,
+	unsigned int xp, unsigned int yp,
+	unsigned int xoffs, unsigned int yoffs, unsigned int page)
 {
-	return (
-	(((r >> 5) & 7) << 5) |
-	(((g >> 5) & 7) << 2) |
-	 ((b >> 6) & 3)	   );
-}
+	unsigned int pic_xs = img->width, pic_ys = img->height;
+	unsigned int line = fb->fix.line_length;
+	int cpp = conv->cpp;
+	int i, xc, yc;
 
-inline static unsigned short make15color(unsigned char r, unsigned char g, unsigned char b)
-{
-	return (
-	(((r >> 3) & 31) << 10) |
-	(((g >> 3) & 31) << 5)  |
-	 ((b >> 3) & 31)		);
-}
+	unsigned char *fbptr;
 
-inline static unsigned short make16color(unsigned char r, unsigned char g, unsigned char b)
-{
-	return (
-	(((r >> 3) & 31) << 11) |
-	(((g >> 2) & 63) << 5)  |
-	 ((b >> 3) & 31)		);
+	xc = (pic_xs > scr_xs) ? scr_xs : pic_xs;
+	yc = (pic_ys > scr_ys) ? scr_ys : pic_ys;
+
+	if(cpp == 1)
+	{
+		get8map(fb, &map_back);
+		set332map(fb);
+	}
+
+	fbptr = fb->mem + (yoffs + page) * line + xoffs * cpp;
+
+	if(img->tiles)
+		blit_tiled(fb, img, conv, fbptr, scr_xs, xp, yp, xoffs, yoffs, xc, yc);
+	else if(!img->rgb)
+		blit_sampled(fb, img, conv, fbptr, scr_xs, xp, yp, xoffs, yoffs, xc, yc);
+	else if(img->alpha && fb->bg)
+	{
+		fb_blend_fn blend = fb_get_blender();
+		unsigned char *bgptr = fb->bg + (yoffs * scr_xs + xoffs) * 3;
+		unsigned char *tmp = (unsigned char*)malloc(xc * 3);
+		unsigned long offs;
+
+		if(!tmp)
+			fprintf(stderr, "Out of memory.\n");
+		for(i = 0; tmp && i < yc; i++, fbptr += line, bgptr += scr_xs * 3)
+			if(img->spans)
+				blit_alpha_row(img, conv, blend, fbptr, bgptr, tmp, xp, yp + i, xc);
+			else
+			{
+				offs = (unsigned long)(yp + i) * img->width + xp;
+				memcpy(tmp, bgptr, xc * 3);
+				blend(tmp, img->rgb + offs * 3, img->alpha + offs, xc);
+				conv->convert(fbptr, tmp, xc);
+			}
+		free(tmp);
+	}
+	else
+		for(i = 0; i < yc; i++, fbptr += line)
+			put_run(img, conv, fbptr, xp, yp + i, xc);
+
+	if(cpp == 1)
+		set8map(fb, &map_back);
 }
 
 void* convertRGB2FB(int fh, unsigned char *rgbbuff, unsigned long count, int bpp, int *cpp)
 {
-	unsigned long i;
-	void *fbbuff = NULL;
-	u_int8_t  *c_fbbuff;
-	u_int16_t *s_fbbuff;
-	u_int32_t *i_fbbuff;
+	const struct fb_converter *conv = fb_get_converter(bpp);
+	void *fbbuff;
 
-	switch(bpp)
+	if(!conv)
 	{
-	case 8:
-		*cpp = 1;
-		c_fbbuff = (unsigned char *) malloc(count * sizeof(unsigned char));
-		for(i = 0; i < count; i++)
-		c_fbbuff[i] = make8color(rgbbuff[i*3], rgbbuff[i*3+1], rgbbuff[i*3+2]);
-		fbbuff = (void *) c_fbbuff;
-		break;
-	case 15:
-		*cpp = 2;
-		s_fbbuff = (unsigned short *) malloc(count * sizeof(unsigned short));
-		for(i = 0; i < count ; i++)
-		s_fbbuff[i] = make15color(rgbbuff[i*3], rgbbuff[i*3+1], rgbbuff[i*3+2]);
-		fbbuff = (void *) s_fbbuff;
-		break;
-	case 16:
-		*cpp = 2;
-		s_fbbuff = (unsigned short *) malloc(count * sizeof(unsigned short));
-		for(i = 0; i < count ; i++)
-		s_fbbuff[i] = make16color(rgbbuff[i*3], rgbbuff[i*3+1], rgbbuff[i*3+2]);
-		fbbuff = (void *) s_fbbuff;
-		break;
-	case 24:
-	    *cpp = 3;
-	    c_fbbuff = (unsigned char *) malloc(count * 3 * sizeof(unsigned char));
-	    for(i = 0; i < (3 * count); i += 3) {
-		/* Big endian framebuffer. */
-		c_fbbuff[i] = rgbbuff[i+2];
-		c_fbbuff[i+1] = rgbbuff[i+1];
-		c_fbbuff[i+2] = rgbbuff[i];
-	    }
-	    fbbuff = (void *) c_fbbuff;
-	    break;
-	case 32:
-		*cpp = 4;
-		i_fbbuff = (unsigned int *) malloc(count * sizeof(unsigned int));
-		for(i = 0; i < count ; i++)
-		i_fbbuff[i] = ((rgbbuff[i*3] << 16) & 0xFF0000) |
-				((rgbbuff[i*3+1] << 8) & 0xFF00) |
-				(rgbbuff[i*3+2] & 0xFF);
-		fbbuff = (void *) i_fbbuff;
-		break;
-	default:
 		fprintf(stderr, "Unsupported video mode! You've got: %dbpp\n", bpp);
 		exit(1);
 	}
+	*cpp = conv->cpp;
+	if((fbbuff = malloc(count * conv->cpp)))
+		conv->convert(fbbuff, rgbbuff, count);
 	return fbbuff;
 }
 
@@ -0,0 +1,165 @@
+/*
+ * fb_memory.c
+ *
+ * A framebuffer that is only memory, for running fbv and timing its
+ * display path where there is no device:
+ *
+ *	mem:<xres>x<yres>[x<bpp>][,line=<bytes>][,yres_virtual=<lines>][,file=<path>]
+ *
+ * bpp defaults to 32, line to the bytes of xres pixels and yres_virtual
+ * to yres (twice yres gives fbv a back page to flip). With a file the
+ * pixels are a shared mapping of it, created or resized as needed, and
+ * are left there for a look afterwards; without one they are anonymous.
+ * Panning moves the offsets the visible page is read from, the colormap
+ * is not kept and there is no vertical blank to wait for.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fbv.h"
+
+static void memory_bitfields(struct fb_var_screeninfo *var)
+{
+	switch(var->bits_per_pixel)
+	{
+		case 15:
+			var->red.offset = 10; var->red.length = 5;
+			var->green.offset = 5; var->green.length = 5;
+			var->blue.length = 5;
+			break;
+		case 16:
+			var->red.offset = 11; var->red.length = 5;
+			var->green.offset = 5; var->green.length = 6;
+			var->blue.length = 5;
+			break;
+		case 24: case 32:
+			var->red.offset = 16; var->red.length = 8;
+			var->green.offset = 8; var->green.length = 8;
+			var->blue.length = 8;
+			break;
+	}
+}
+
+static int memory_open(struct fb_context *fb, const char *name)
+{
+	struct fb_var_screeninfo *var = &fb->var;
+	struct fb_fix_screeninfo *fix = &fb->fix;
+	unsigned int xres, yres, bpp = 32, line = 0, yvirt = 0;
+	const char *opt, *file = NULL;
+	int n;
+
+	if(sscanf(name, "mem:%ux%u%n", &xres, &yres, &n) < 2)
+		goto bad;
+	opt = name + n;
+	if(sscanf(opt, "x%u%n", &bpp, &n) == 1)
+		opt += n;
+	while(*opt == ',')
+	{
+		opt++;
+		if(sscanf(opt, "line=%u%n", &line, &n) == 1 ||
+		   sscanf(opt, "yres_virtual=%u%n", &yvirt, &n) == 1)
+			opt += n;
+		else if(!strncmp(opt, "file=", 5))
+		{
+			/* the rest, commas and all */
+			file = opt + 5;
+			opt += strlen(opt);
+		}
+		else
+			goto bad;
+	}
+	if(*opt || !xres || !yres)
+		goto bad;
+	if(!fb_get_converter(bpp))
+	{
+		fprintf(stderr, "%s: unsupported depth %ubpp\n", name, bpp);
+		return -1;
+	}
+	if(!line)
+		line = xres * ((bpp + 7) / 8);
+	if(!yvirt)
+		yvirt = yres;
+	if(line < xres * ((bpp + 7) / 8) || yvirt < yres)
+		goto bad;
+
+	var->xres = var->xres_virtual = xres;
+	var->yres = yres;
+	var->yres_virtual = yvirt;
+	var->bits_per_pixel = bpp;
+	memory_bitfields(var);
+	strcpy(fix->id, "fbv memory");
+	fix->type = FB_TYPE_PACKED_PIXELS;
+	fix->visual = bpp == 8 ? FB_VISUAL_PSEUDOCOLOR : FB_VISUAL_TRUECOLOR;
+	fix->line_length = line;
+	fix->ypanstep = 1;
+	fb->mem_size = (size_t)line * yvirt;
+	fix->smem_len = fb->mem_size;
+
+	if(file)
+	{
+		if((fb->fh = open(file, O_RDWR | O_CREAT, 0644)) == -1 ||
+		   ftruncate(fb->fh, fb->mem_size))
+		{
+			perror(file);
+			if(fb->fh != -1)
+				close(fb->fh);
+			fb->fh = -1;
+			return -1;
+		}
+		fb->mem = (unsigned char*)mmap(NULL, fb->mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fh, 0);
+	}
+	else
+		fb->mem = (unsigned char*)mmap(NULL, fb->mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(fb->mem == MAP_FAILED)
+	{
+		perror("mmap");
+		if(fb->fh != -1)
+			close(fb->fh);
+		fb->fh = -1;
+		fb->mem = NULL;
+		return -1;
+	}
+	return 0;
+
+bad:
+	fprintf(stderr, "%s: expected mem:<xres>x<yres>[x<bpp>][,line=<bytes>][,yres_virtual=<lines>][,file=<path>]\n", name);
+	return -1;
+}
+
+static void memory_close(struct fb_context *fb)
+{
+	munmap(fb->mem, fb->mem_size);
+	if(fb->fh != -1)
+		close(fb->fh);
+}
+
+static int memory_pan(struct fb_context *fb, const struct fb_var_screeninfo *var)
+{
+	if(var->xoffset + fb->var.xres > fb->var.xres_virtual ||
+	   var->yoffset + fb->var.yres > fb->var.yres_virtual)
+		return -1;
+	return 0;
+}
+
+static int memory_wait_vsync(struct fb_context *fb)
+{
+	return -1;
+}
+
+static int memory_cmap(struct fb_context *fb, struct fb_cmap *map)
+{
+	return 0;
+}
+
+const struct fb_backend fb_memory_backend =
+{
+	"memory", memory_open, memory_close, memory_pan, memory_wait_vsync, memory_cmap, memory_cmap
+};
@@ -0,0 +1,235 @@
+/*
+ * fbbench.c
+ *
+ * Times what fbv does with a picture, stage by stage, one CSV line per
+ * file on stdout:
+ *
+ *	decode		the file to RGB888 and alpha at full size, as fbv -a
+ *	levels		for a filtered shrink, the picture halved while it is
+ *			still twice the fitted size, as fbv does the first time
+ *	display		the first fb_display() of the fitted image: sampled
+ *			band by band, blended over the background, converted
+ *			into the framebuffer and shown
+ *	redraw		fb_display() of the same image again, as after panning
+ *
+ * Each figure is the best of the runs, in milliseconds. The framebuffer
+ * is opened as by fbv, so FRAMEBUFFER=mem:... (or -f) needs no device.
+ */
+
+#include "config.h"
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fbv.h"
+
+enum { DECODE, LEVELS, DISPLAY, REDRAW, STAGES };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static unsigned char *decode(const char *filename, int *width, int *height, unsigned char **alpha)
+{
+	const struct fh_loader *l;
+	unsigned char hdr[FH_HEADER_LEN], *rgb = NULL;
+	int len;
+	FILE *fh;
+
+	*alpha = NULL;
+	if(!(fh = fopen(filename, "rb")))
+		return NULL;
+	if((l = fh_identify(fh, hdr, &len, width, height)) &&
+	   (rgb = (unsigned char*)malloc((size_t)*width * *height * 3)) &&
+	   l->load(fh, rgb, alpha, *width, *height, NULL, NULL) != FH_ERROR_OK)
+	{
+		free(rgb);
+		free(*alpha);
+		rgb = NULL;
+		*alpha = NULL;
+	}
+	fclose(fh);
+	return rgb;
+}
+
+/* one run over a file: the time of each stage, and the size shown */
+static int bench(struct fb_context *fb, const char *filename, int filter,
+	double *ms, int *width, int *height, int *nx, int *ny)
+{
+	int screen_width = fb->var.xres, screen_height = fb->var.yres;
+	unsigned char *rgb, *alpha, *src_rgb, *src_alpha, *half;
+	int w, h, x_offs, y_offs, failed = 0;
+	struct image img;
+	double t;
+
+	t = now();
+	if(!(rgb = decode(filename, width, height, &alpha)))
+		return -1;
+	ms[DECODE] = now() - t;
+
+	*nx = *width;
+	*ny = *height;
+	if(*width > screen_width || *height > screen_height)
+	{
+		if((long)*width * screen_height > (long)*height * screen_width)
+		{
+			*nx = screen_width;
+			*ny = (long)*height * screen_width / *width;
+		}
+		else
+		{
+			*ny = screen_height;
+			*nx = (long)*width * screen_height / *height;
+		}
+		if(*nx < 1)
+			*nx = 1;
+		if(*ny < 1)
+			*ny = 1;
+	}
+
+	memset(&img, 0, sizeof(img));
+	img.width = *nx;
+	img.height = *ny;
+	src_rgb = rgb;
+	src_alpha = alpha;
+	w = *width;
+	h = *height;
+	t = now();
+	if(*nx == *width && *ny == *height)
+	{
+		img.rgb = rgb;
+		img.alpha = alpha;
+	}
+	else
+	{
+		/* each level is only needed while it is made from */
+		while(filter && !failed && w / 2 >= *nx && h / 2 >= *ny)
+		{
+			if(!(half = halve(src_rgb, w, h, 3)))
+				failed = 1;
+			else
+			{
+				if(src_rgb != rgb)
+					free(src_rgb);
+				src_rgb = half;
+			}
+			if(!failed && src_alpha && !(half = halve(src_alpha, w, h, 1)))
+				failed = 1;
+			else if(!failed && src_alpha)
+			{
+				if(src_alpha != alpha)
+					free(src_alpha);
+				src_alpha = half;
+			}
+			w /= 2;
+			h /= 2;
+		}
+		img.src_rgb = src_rgb;
+		img.src_alpha = src_alpha;
+		img.src_width = w;
+		img.src_height = h;
+		img.filter = filter;
+	}
+	ms[LEVELS] = now() - t;
+
+	x_offs = screen_width > *nx ? (screen_width - *nx) / 2 : 0;
+	y_offs = screen_height > *ny ? (screen_height - *ny) / 2 : 0;
+	if(!failed)
+	{
+		t = now();
+		failed = fb_display(fb, &img, 0, 0, x_offs, y_offs) ? 1 : 0;
+		ms[DISPLAY] = now() - t;
+		t = now();
+		failed |= fb_display(fb, &img, 0, 0, x_offs, y_offs) ? 1 : 0;
+		ms[REDRAW] = now() - t;
+	}
+
+	fb_image_invalidate(&img);
+	if(src_rgb != rgb)
+		free(src_rgb);
+	if(src_alpha != alpha)
+		free(src_alpha);
+	free(rgb);
+	free(alpha);
+	return failed ? -1 : 0;
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr, "Usage: %s [-f framebuffer] [-r runs] [-F filter] image...\n\n"
+		"  -f <framebuffer>  Device, or mem:<xres>x<yres>[x<bpp>]... (default $FRAMEBUFFER)\n"
+		"  -r <runs>         Time each file this many times, keep the best (default 5)\n"
+		"  -F <filter>       Shrink with 0 nearest neighbour, 1 smooth, 2 Lanczos (default 1)\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	const char *device = NULL;
+	int runs = 5, filter = RESAMPLE_SMOOTH, failed = 0;
+	int c, i, r, s, width, height, nx, ny;
+	double ms[STAGES], best[STAGES];
+	struct fb_context fb;
+
+	while((c = getopt(argc, argv, "f:r:F:h")) != EOF)
+	{
+		switch(c)
+		{
+			case 'f':
+				device = optarg;
+				break;
+			case 'r':
+				runs = atoi(optarg);
+				break;
+			case 'F':
+				filter = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if(optind >= argc || runs < 1 || filter < 0 || filter > RESAMPLE_LANCZOS)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if(fb_open(&fb, device))
+		return 1;
+	if(!fb_get_converter(fb.var.bits_per_pixel))
+	{
+		fprintf(stderr, "Unsupported video mode! You've got: %dbpp\n", fb.var.bits_per_pixel);
+		fb_close(&fb);
+		return 1;
+	}
+
+	printf("file,width,height,shown_width,shown_height,bpp,converter,decode_ms,levels_ms,display_ms,redraw_ms\n");
+	for(i = optind; i < argc; i++)
+	{
+		for(r = 0; r < runs; r++)
+		{
+			if(bench(&fb, argv[i], filter, ms, &width, &height, &nx, &ny))
+				break;
+			for(s = 0; s < STAGES; s++)
+				if(!r || ms[s] < best[s])
+					best[s] = ms[s];
+		}
+		if(r < runs)
+		{
+			fprintf(stderr, "%s: cannot be decoded\n", argv[i]);
+			failed = 1;
+			continue;
+		}
+		printf("%s,%d,%d,%d,%d,%d,%s,%.3f,%.3f,%.3f,%.3f\n", argv[i], width, height, nx, ny,
+			fb.var.bits_per_pixel, fb_get_converter(fb.var.bits_per_pixel)->name,
+			best[DECODE], best[LEVELS], best[DISPLAY], best[REDRAW]);
+		fflush(stdout);
+	}
+
+	fb_close(&fb);
+	return failed;
+}
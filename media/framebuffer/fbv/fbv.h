@@ -5,39 +5,285 @@
 #define FH_ERROR_FILE   1	/* read/access error */
 #define FH_ERROR_FORMAT 2	/* file format error */
 
-int fb_display(unsigned char *rgbbuff, unsigned char * alpha,
-               unsigned int x_size, unsigned int y_size,
+#include <stddef.h>
+#include <stdio.h>
+#include <linux/fb.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fb_backend;
+
+/* framebuffer state kept open for the whole run */
+struct fb_context
+{
+	const struct fb_backend *backend;
+	int fh;
+	struct fb_var_screeninfo var;
+	struct fb_fix_screeninfo fix;
+	unsigned char *mem;	/* the whole framebuffer, mapped once */
+	size_t mem_size;
+	unsigned char *bg;	/* RGB888 of the screen under images with alpha */
+	int pages;		/* 2: draw into the back page, then pan to it */
+	int back;		/* page drawn next */
+	int vsync;		/* FBIO_WAITFORVSYNC: 0 untried, 1 works, -1 not */
+	unsigned int orig_yoffset;
+};
+
+/*
+ * What is behind a framebuffer. open() fills in fb's var, fix, mem and
+ * mem_size (and fh, if it uses one) for the named framebuffer, close()
+ * undoes it; the others return non-zero where the backend cannot do it.
+ */
+struct fb_backend
+{
+	const char *name;
+	int (*open)(struct fb_context *fb, const char *name);
+	void (*close)(struct fb_context *fb);
+	int (*pan)(struct fb_context *fb, const struct fb_var_screeninfo *var);
+	int (*wait_vsync)(struct fb_context *fb);
+	int (*get_cmap)(struct fb_context *fb, struct fb_cmap *map);
+	int (*set_cmap)(struct fb_context *fb, struct fb_cmap *map);
+};
+
+extern const struct fb_backend fb_fbdev_backend;
+extern const struct fb_backend fb_memory_backend;
+
+struct image;
+
+int fb_open(struct fb_context *fb, const char *name);
+void fb_close(struct fb_context *fb);
+int fb_display(struct fb_context *fb, struct image *i,
                unsigned int x_pan, unsigned int y_pan,
                unsigned int x_offs, unsigned int y_offs);
-int getCurrentRes(int *x, int *y);
+int fb_display_rows(struct fb_context *fb, struct image *i,
+               unsigned int x_pan, unsigned int y_pan,
+               unsigned int x_offs, unsigned int y_offs,
+               unsigned int y0, unsigned int y1);
+void fb_image_invalidate(struct image *i);
+void fb_clear_screen(struct fb_context *fb);
+void fb_draw_rgb(struct fb_context *fb, const unsigned char *rgb, size_t stride,
+               int width, int height, int x, int y);
+int getCurrentRes(struct fb_context *fb, int *x, int *y);
 void vt_setup();
 
+/* RGB888 to framebuffer pixels, one row or a whole buffer at a time */
+typedef void (*fb_convert_fn)(void *dst, const unsigned char *rgb, unsigned long count);
+
+struct fb_converter
+{
+	const char *name;
+	int bpp, cpp;
+	fb_convert_fn convert;
+	int (*supported)(void);
+};
+
+extern const struct fb_converter fb_converters[];
+const struct fb_converter *fb_get_converter(int bpp);
+void fb_unpack_row(int bpp, unsigned char *rgb, const void *src, unsigned long count);
+
+/* RGB888 src over dst with per pixel alpha */
+typedef void (*fb_blend_fn)(unsigned char *dst, const unsigned char *src, const unsigned char *alpha, unsigned long count);
+
+struct fb_blender
+{
+	const char *name;
+	fb_blend_fn blend;
+	int (*supported)(void);
+};
+
+extern const struct fb_blender fb_blenders[];
+fb_blend_fn fb_get_blender(void);
+
+/* decoded RGBA to RGB888 and alpha */
+typedef void (*fb_split_fn)(unsigned char *rgb, unsigned char *alpha, const unsigned char *rgba, unsigned long count);
+
+struct fb_splitter
+{
+	const char *name;
+	fb_split_fn split;
+	int (*supported)(void);
+};
+
+extern const struct fb_splitter fb_splitters[];
+fb_split_fn fb_get_splitter(void);
+
+/*
+ * An image format. The file is opened once and its first bytes read;
+ * id() recognizes the format from those, getsize() and load() get the
+ * open file and the same bytes and do not close it. getsize() gives the
+ * size load() will decode to. Loaders that can decode at a reduced size
+ * (JPEG) pick the smallest one not under wanted_x x wanted_y; 0, 0 or
+ * the other loaders give full size.
+ */
+#define FH_HEADER_LEN	32
+
+/*
+ * load() calls progress, if not NULL, whenever rows y0 .. y1 - 1 of
+ * buffer (and *alpha, set by then) have been decoded, or decoded again
+ * at a better quality: progressive JPEG and interlaced PNG files come
+ * as a few coarse passes over the whole image first.
+ *
+ * load_rows() hands each decoded row to a callback instead, top down,
+ * with alpha NULL when the file has none; a non-zero return stops it.
+ * Formats that cannot give rows in order (interlaced PNG) fail.
+ */
+typedef void (*fh_progress_fn)(void *ctx, int y0, int y1);
+typedef int (*fh_row_fn)(void *ctx, int y, const unsigned char *rgb, const unsigned char *alpha);
+
+struct fh_loader
+{
+	const char *name;
+	int (*id)(const unsigned char *hdr, int len);
+	int (*getsize)(FILE *fh, const unsigned char *hdr, int len, int *x, int *y, int wanted_x, int wanted_y);
+	int (*load)(FILE *fh, unsigned char *buffer, unsigned char **alpha, int x, int y,
+		fh_progress_fn progress, void *ctx);
+	int (*load_rows)(FILE *fh, int x, int y, fh_row_fn row, void *ctx);
+};
+
 #ifdef FBV_SUPPORT_BMP
-int fh_bmp_id(char *name);
-int fh_bmp_load(char *name, unsigned char *buffer, unsigned char **alpha, int x,int y);
-int fh_bmp_getsize(char *name, int *x, int *y);
+extern const struct fh_loader fh_bmp_loader;
 #endif
 
 #ifdef FBV_SUPPORT_JPEG
-int fh_jpeg_id(char *name);
-int fh_jpeg_load(char *name, unsigned char *buffer, unsigned char **alpha, int x,int y);
-int fh_jpeg_getsize(char *name, int *x, int *y);
+extern const struct fh_loader fh_jpeg_loader;
 #endif
 
 #ifdef FBV_SUPPORT_PNG
-int fh_png_id(char *name);
-int fh_png_load(char *name, unsigned char *buffer, unsigned char **alpha, int x,int y);
-int fh_png_getsize(char *name, int *x, int *y);
+extern const struct fh_loader fh_png_loader;
 #endif
 
+/* the loaders above, NULL terminated, and the one that reads an open file */
+extern const struct fh_loader * const fh_loaders[];
+const struct fh_loader *fh_identify(FILE *fh, unsigned char *hdr, int *len, int *width, int *height);
+
+/* a run of fully opaque or of partly transparent pixels in an alpha row */
+struct alpha_span
+{
+	int start, len;
+	int opaque;
+};
+
+struct sampler;
+
+/*
+ * A picture too big to keep decoded in memory: its full size pixels
+ * cut into TILE_SIZE squares in an unlinked temporary file, of which
+ * only the least recently used few stay mapped, and after them those of
+ * each level of a pyramid halving it. A tile is TILE_SIZE rows of rgb,
+ * then as many of alpha if the picture has it; edge tiles are padded.
+ */
+#define TILE_SIZE	256
+#define TILE_LEVELS	8
+
+struct tile_level
+{
+	int width, height;
+	int columns, rows;
+	size_t first;		/* index of its first tile in the file */
+};
+
+struct tile_slot
+{
+	int index;		/* tile mapped here, or -1 */
+	unsigned long used;	/* clock at the last tiles_get() of it */
+	unsigned char *map;
+};
+
+struct tiles
+{
+	int width, height;
+	int alpha;
+	struct tile_level level[TILE_LEVELS];	/* level[0] is the full size */
+	int nlevels;
+	size_t block;		/* bytes per tile, page aligned */
+	int fd;
+	struct tile_slot *slots;
+	int nslots;
+	unsigned long clock;
+};
+
 struct image
 {
 	int width, height;
 	unsigned char *rgb;
 	unsigned char *alpha;
 	int do_free;
+
+	/* with tiles set the image is them, shown at full size */
+	struct tiles *tiles;
+
+	/* with rgb NULL the image is not kept anywhere: bands of it are
+	 * sampled from src_* at display time, turned by rotation as by
+	 * rotate() and scaled with filter (0 for nearest neighbour); with
+	 * src_tiles set instead of src_rgb, from level src_level of them */
+	const unsigned char *src_rgb, *src_alpha;
+	struct tiles *src_tiles;
+	int src_level;
+	int src_width, src_height;
+	int rotation, filter;
+	struct sampler *sampler;
+
+	/* rgb converted to the framebuffer format, built when the image is
+	 * displayed a second time, and the visible runs of alpha, built on
+	 * first display; both kept until the image changes */
+	int shown;
+	unsigned char *fbbuff;
+	int cpp;
+	struct alpha_span *spans;
+	int *span_rows;	/* spans of row y: span_rows[y] .. span_rows[y + 1] - 1 */
+};
+
+/* a decoded file and the image it is first shown as */
+struct picture
+{
+	const char *error;	/* why it could not be loaded, or NULL */
+	int width, height;
+	unsigned char *rgb, *alpha;	/* as decoded */
+	int orig_width, orig_height;	/* of the file, if decoded smaller */
+	struct tiles *tiles;	/* the full size, if rgb is only an overview */
+	struct image first;	/* after the initial transformations */
 };
 
+int tiles_load(struct picture *p, const struct fh_loader *l, FILE *fh, int alpha);
+int tiles_overview(struct picture *p, const struct fh_loader *l, FILE *fh, int max, int alpha);
+const unsigned char *tiles_get(struct tiles *t, int level, int column, int row);
+int tiles_read(struct tiles *t, int level, int x, int y, int width, int height, unsigned char *rgb, unsigned char *alpha);
+void tiles_free(struct tiles *t);
+
+/*
+ * Thumbnails of a list of files, at most THUMB_SIZE pixels on a side,
+ * made by a pool of threads around the files asked for and kept in an
+ * on disk cache between runs. thumbs_fd() becomes readable whenever one
+ * is done.
+ */
+#define THUMB_SIZE	128
+
+struct thumb
+{
+	int width, height;
+	unsigned char *rgb;
+};
+
+typedef int (*thumb_make_fn)(char *filename, int size, struct thumb *t);
+
+int thumbs_start(char **files, int count, thumb_make_fn make);
+void thumbs_want(int first, int count);
+int thumbs_get(int index, struct thumb *t);
+int thumbs_fd(void);
+void thumbs_stop(void);
+
+typedef void (*prefetch_prepare_fn)(char *filename, struct picture *p);
+typedef void (*prefetch_release_fn)(struct picture *p);
+typedef size_t (*prefetch_estimate_fn)(char *filename);
+
+int prefetch_start(char **files, int count, int ahead, size_t budget,
+	prefetch_prepare_fn prepare, prefetch_release_fn release, prefetch_estimate_fn estimate);
+struct picture *prefetch_get(int index);
+void prefetch_put(struct picture *p);
+void prefetch_stop(void);
+
 #ifndef min
 #define min(a,b) ((a) < (b) ? (a) : (b))
 #endif
@@ -47,9 +293,40 @@ struct image
 
 unsigned char * simple_resize(unsigned char * orgin,int ox,int oy,int dx,int dy);
 unsigned char * alpha_resize(unsigned char * alpha,int ox,int oy,int dx,int dy);
-unsigned char * color_average_resize(unsigned char * orgin,int ox,int oy,int dx,int dy);
+
+/* resample() filters, the values of the smooth resize quality */
+#define RESAMPLE_SMOOTH		1	/* area when shrinking, bilinear when enlarging */
+#define RESAMPLE_LANCZOS	2	/* Lanczos-2: sharper, may ring a little */
+
+/* dst[i] = sum of weight[k] * rows[k][i] over the taps, in 1.14 fixed point */
+typedef void (*resample_rows_fn)(unsigned char *dst, const unsigned char * const *rows,
+	const short *weight, int taps, unsigned long count);
+
+struct resample_kernel
+{
+	const char *name;
+	resample_rows_fn rows;
+	int (*supported)(void);
+};
+
+extern const struct resample_kernel resample_kernels[];
+unsigned char *resample(const unsigned char *src, int ox, int oy, int dx, int dy, int channels, int filter);
+unsigned char *halve(const unsigned char *src, int ox, int oy, int channels);
+struct sampler *sampler_new(int ox, int oy, int rotation, int dx, int dy, int filter);
+int sampler_rows(const struct sampler *s, const unsigned char *src, int channels,
+	int y0, int y1, int x0, int len, unsigned char *dst, size_t stride);
+void sampler_source(const struct sampler *s, int y0, int y1, int x0, int len,
+	int *sx, int *sy, int *width, int *height);
+int sampler_rows_from(const struct sampler *s, const unsigned char *src, int sx, int sy, int width,
+	int channels, int y0, int y1, int x0, int len, unsigned char *dst, size_t stride);
+void sampler_free(struct sampler *s);
 unsigned char * rotate(unsigned char *i, int ox, int oy, int rot);
 unsigned char * alpha_rotate(unsigned char *i, int ox, int oy, int rot);
+void rotate_tiled(unsigned char *n, const unsigned char *i, size_t stride, int ox, int oy, int rot, int bpp);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
 
@@ -5,11 +5,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <jpeglib.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <setjmp.h>
-#include <unistd.h>
 
 struct r_jpeg_error_mgr
 {
@@ -18,19 +14,36 @@ struct r_jpeg_error_mgr
 };
 
 
-int fh_jpeg_id(char *name)
+static int fh_jpeg_id(const unsigned char *id, int len)
 {
-	int fd;
-	unsigned char id[10];
-	fd = open(name,O_RDONLY); if(fd==-1) return(0);
-	read(fd,id,10);
- 	close(fd);
-	if(id[6]=='J' && id[7]=='F' && id[8]=='I' && id[9]=='F') return(1);
-	if(id[0]==0xff && id[1]==0xd8 && id[2]==0xff) return(1);
+	if(len >= 10 && id[6]=='J' && id[7]=='F' && id[8]=='I' && id[9]=='F') return(1);
+	if(len >= 3 && id[0]==0xff && id[1]==0xd8 && id[2]==0xff) return(1);
 	return(0);
 }
 
 
+/*
+ * Let libjpeg scale the DCT by the smallest M/8 that still gives at
+ * least wx x wy pixels; full size when no size is wanted.
+ */
+static void jpeg_pick_scale(j_decompress_ptr ciptr, int wx, int wy)
+{
+	int m;
+
+	ciptr->scale_denom = 8;
+	ciptr->scale_num = 8;
+	if(wx > 0 || wy > 0)
+		for(m = 1; m < 8; m++)
+		{
+			ciptr->scale_num = m;
+			jpeg_calc_output_dimensions(ciptr);
+			if((int)ciptr->output_width >= wx && (int)ciptr->output_height >= wy)
+				return;
+		}
+	ciptr->scale_num = 8;
+	jpeg_calc_output_dimensions(ciptr);
+}
+
 void jpeg_cb_error_exit(j_common_ptr cinfo)
 {
 	struct r_jpeg_error_mgr *mptr;
@@ -39,24 +52,37 @@ void jpeg_cb_error_exit(j_common_ptr cinfo)
 	longjmp(mptr->envbuffer, 1);
 }
 
-int fh_jpeg_load(char *filename, unsigned char *buffer, unsigned char ** alpha, int x, int y)
+/* all the rows of one output pass; non-zero if row() stopped it */
+static int jpeg_read_pass(j_decompress_ptr ciptr, JSAMPLE *lb, fh_row_fn row, void *ctx)
+{
+	while (ciptr->output_scanline < ciptr->output_height)
+	{
+		jpeg_read_scanlines(ciptr, &lb, 1);
+		if(row(ctx, ciptr->output_scanline - 1, lb, NULL))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * With passes set, a progressive file is output twice: once as soon as
+ * its first scan is in, then complete.
+ */
+static int jpeg_decode(FILE *fh, int x, int y, int passes, fh_row_fn row, void *ctx)
 {
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_decompress_struct *ciptr;
 	struct r_jpeg_error_mgr emgr;
-	unsigned char *bp;
-	int px, c;
-	FILE *fh;
+	int c;
 	JSAMPLE *lb;
 
 	ciptr = &cinfo;
-	if(!(fh=fopen(filename,"rb"))) return(FH_ERROR_FILE);
+	rewind(fh);
 	ciptr->err = jpeg_std_error(&emgr.pub);
 	emgr.pub.error_exit = jpeg_cb_error_exit;
 	if(setjmp(emgr.envbuffer))
 	{
 		jpeg_destroy_decompress(ciptr);
-		fclose(fh);
 		return(FH_ERROR_FORMAT);
 	}
 
@@ -64,45 +90,95 @@ int fh_jpeg_load(char *filename, unsigned char *buffer, unsigned char ** alpha,
 	jpeg_stdio_src(ciptr, fh);
 	jpeg_read_header(ciptr, TRUE);
 	ciptr->out_color_space = JCS_RGB;
+
+	/* x, y come from fh_jpeg_getsize() and pick the same scaling */
+	jpeg_pick_scale(ciptr, x, y);
+	if((int)ciptr->output_width != x || (int)ciptr->output_height != y)
+	{
+		jpeg_destroy_decompress(ciptr);
+		return(FH_ERROR_FORMAT);
+	}
+	ciptr->buffered_image = passes && jpeg_has_multiple_scans(ciptr);
 	jpeg_start_decompress(ciptr);
 
-	px = ciptr->output_width;
 	c = ciptr->output_components;
 
 	if(c==3)
 	{
-		lb = (JSAMPLE*)(*ciptr->mem->alloc_small)((j_common_ptr)ciptr, JPOOL_PERMANENT, c*px);
-		bp = buffer;
-		while (ciptr->output_scanline < ciptr->output_height)
+		lb = (JSAMPLE*)(*ciptr->mem->alloc_small)((j_common_ptr)ciptr, JPOOL_PERMANENT, c*x);
+		if(!ciptr->buffered_image)
 		{
-			jpeg_read_scanlines(ciptr, &lb, 1);
-			memcpy(bp, lb, px*c);
-			bp += px*c;
+			if(jpeg_read_pass(ciptr, lb, row, ctx))
+				goto stopped;
 		}
+		else
+			while(1)
+			{
+				jpeg_start_output(ciptr, ciptr->input_scan_number);
+				if(jpeg_read_pass(ciptr, lb, row, ctx))
+					goto stopped;
+				jpeg_finish_output(ciptr);
+				if(jpeg_input_complete(ciptr) && ciptr->output_scan_number == ciptr->input_scan_number)
+					break;
+				while(!jpeg_input_complete(ciptr))
+					jpeg_consume_input(ciptr);
+			}
 	}
 	jpeg_finish_decompress(ciptr);
 	jpeg_destroy_decompress(ciptr);
-	fclose(fh);
 	return(FH_ERROR_OK);
+stopped:
+	jpeg_destroy_decompress(ciptr);
+	return(FH_ERROR_FILE);
+}
+
+static int fh_jpeg_load_rows(FILE *fh, int x, int y, fh_row_fn row, void *ctx)
+{
+	return jpeg_decode(fh, x, y, 0, row, ctx);
+}
+
+struct jpeg_buffer
+{
+	unsigned char *bp;
+	int x;
+	fh_progress_fn progress;
+	void *ctx;
+};
+
+static int copy_row(void *ctx, int y, const unsigned char *rgb, const unsigned char *alpha)
+{
+	struct jpeg_buffer *b = (struct jpeg_buffer*)ctx;
+
+	memcpy(b->bp + (size_t)b->x * 3 * y, rgb, b->x * 3);
+	if(b->progress)
+		b->progress(b->ctx, y, y + 1);
+	return 0;
 }
 
-int fh_jpeg_getsize(char *filename, int *x, int *y)
+static int fh_jpeg_load(FILE *fh, unsigned char *buffer, unsigned char ** alpha, int x, int y,
+	fh_progress_fn progress, void *ctx)
+{
+	struct jpeg_buffer b = { buffer, x, progress, ctx };
+
+	return jpeg_decode(fh, x, y, progress != NULL, copy_row, &b);
+}
+
+/* the size sits in the SOF marker, possibly after a long EXIF block: let libjpeg find it */
+static int fh_jpeg_getsize(FILE *fh, const unsigned char *hdr, int len, int *x, int *y, int wanted_x, int wanted_y)
 {
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_decompress_struct *ciptr;
 	struct r_jpeg_error_mgr emgr;
 	int px, py;
-	FILE *fh;
 
 	ciptr = &cinfo;
-	if(!(fh=fopen(filename,"rb"))) return(FH_ERROR_FILE);
+	rewind(fh);
 
 	ciptr->err = jpeg_std_error(&emgr.pub);
 	emgr.pub.error_exit = jpeg_cb_error_exit;
 	if(setjmp(emgr.envbuffer))
 	{
 		jpeg_destroy_decompress(ciptr);
-		fclose(fh);
 		return(FH_ERROR_FORMAT);
 	}
 
@@ -110,14 +186,15 @@ int fh_jpeg_getsize(char *filename, int *x, int *y)
 	jpeg_stdio_src(ciptr, fh);
 	jpeg_read_header(ciptr, TRUE);
 	ciptr->out_color_space = JCS_RGB;
-	jpeg_start_decompress(ciptr);
+	jpeg_pick_scale(ciptr, wanted_x, wanted_y);
 	px = ciptr->output_width;
 	py = ciptr->output_height;
 	*x = px;
 	*y = py;
 	jpeg_destroy_decompress(ciptr);
-	fclose(fh);
 	return(FH_ERROR_OK);
 }
+
+const struct fh_loader fh_jpeg_loader = { "JPEG", fh_jpeg_id, fh_jpeg_getsize, fh_jpeg_load, fh_jpeg_load_rows };
 #endif /*FBV_SUPPORT_JPEG*/
 
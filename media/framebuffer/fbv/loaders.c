@@ -0,0 +1,37 @@
+/*
+ * loaders.c
+ *
+ * The image formats built in, and which of them an open file is in.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include "fbv.h"
+
+/* tried in this order on the first bytes of each file */
+const struct fh_loader * const fh_loaders[] =
+{
+#ifdef FBV_SUPPORT_PNG
+	&fh_png_loader,
+#endif
+#ifdef FBV_SUPPORT_JPEG
+	&fh_jpeg_loader,
+#endif
+#ifdef FBV_SUPPORT_BMP
+	&fh_bmp_loader,
+#endif
+	NULL
+};
+
+/* one read identifies an open file: its loader and full size, or NULL */
+const struct fh_loader *fh_identify(FILE *fh, unsigned char *hdr, int *len, int *width, int *height)
+{
+	const struct fh_loader * const *l;
+
+	*len = fread(hdr, 1, FH_HEADER_LEN, fh);
+	for(l = fh_loaders; *l; l++)
+		if((*l)->id(hdr, *len) && (*l)->getsize(fh, hdr, *len, width, height, 0, 0) == FH_ERROR_OK)
+			return *l;
+	return NULL;
+}
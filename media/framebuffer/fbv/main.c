@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <termios.h>
 #include <signal.h>
 
@@ -27,15 +28,22 @@ static int opt_smartfit = -1;
 static int opt_delay = 0;
 static int opt_enlarge = 0;
 static int opt_ignore_aspect = 0;
+static int opt_prefetch = 2;
+static int opt_prefetch_mem = 256;
+static int opt_tile_mem = 128;
+static int opt_progressive = 0;
+static int opt_grid = 0;
+static pthread_t main_thread;
 static char *imagename = NULL;
+static struct fb_context fb;
 
 static char inline_status[] =
 	"\nviewer status:\n"
 	"%cshrink(f)%c          %cquality shrin(k)%c    %c(e)nlarge%c\n"
 	"%chorizonta(l)_fit%c   %cver(t)ical_fit%c      %caspect(i)%c\n"
 	" zoom:%g\n";
-static char opener[2] = {' ', '['};
-static char closer[2] = {' ', ']'};
+static char opener[3] = {' ', '[', '{'};
+static char closer[3] = {' ', ']', '}'};
 
 static char inline_help[] =
 	"keys:\n"
@@ -44,7 +52,7 @@ static char inline_help[] =
 	"> or .		Next image\n"
 	"a, d, w, x	Scroll the image (cursor keys also do that)\n"
 	"f		Toggle shrinking on/off\n"
-	"k		Toggle shrinking quality\n"
+	"k		Cycle resizing quality: simple, [smooth], {sharp}\n"
 	"e		Toggle enlarging on/off\n"
 	"l		Toggle fitting the image horizontally\n"
 	"t		Toggle fitting the image vertically\n"
@@ -82,290 +90,624 @@ void setup_console(int t)
 	}
  }
 
-static inline void do_rotate(struct image *i, int rot)
+/* the size a width x height image is enlarged to so it fills the screen, or 0 if it stays */
+static int enlarge_size(int width, int height, int screen_width, int screen_height, int ignoreaspect, int widthonly, int heightonly, int *nx, int *ny)
 {
-	if(rot)
+	if(((width > screen_width) || (height > screen_height)) && (!ignoreaspect))
+		return 0;
+	if((width >= screen_width) && (height >= screen_height))
+		return 0;
+
+	*nx = width;
+	*ny = height;
+	if(ignoreaspect)
 	{
-		unsigned char *image, *alpha = NULL;
-		int t;
+		if(width < screen_width)
+			*nx = screen_width;
+		if(height < screen_height)
+			*ny = screen_height;
+	}
+	else if(widthonly) {
+		*nx = screen_width;
+		*ny = height * screen_width / width;
+	}
+	else if(heightonly) {
+		*nx = width * screen_height / height;
+		*ny = screen_height;
+	}
+	else if((height * screen_width / width) <= screen_height)
+	{
+		*nx = screen_width;
+		*ny = height * screen_width / width;
+	}
+	else if((width * screen_height / height) <= screen_width)
+	{
+		*nx = width * screen_height / height;
+		*ny = screen_height;
+	}
+	else
+		return 0;
+	return 1;
+}
 
-		image = rotate(i->rgb, i->width, i->height, rot);
-		if(i->alpha)
-			alpha = alpha_rotate(i->alpha, i->width, i->height, rot);
-		if(i->do_free)
-		{
-			free(i->alpha);
-			free(i->rgb);
-		}
 
-		i->rgb = image;
-		i->alpha = alpha;
-		i->do_free = 1;
+/* the size a width x height image is shrunk to so it fits the screen */
+static void fit_size(int width, int height, int screen_width, int screen_height, int ignoreaspect, int widthonly, int heightonly, int *nx, int *ny)
+{
+	int nx_size = width, ny_size = height;
 
-		if(rot & 1)
+	if(ignoreaspect)
+	{
+		if(width > screen_width)
+			nx_size = screen_width;
+		if(height > screen_height)
+			ny_size = screen_height;
+	}
+	else if(widthonly) {
+		nx_size = screen_width;
+		ny_size = height * screen_width / width;
+	}
+	else if(heightonly) {
+		nx_size = width * screen_height / height;
+		ny_size = screen_height;
+	}
+	else
+	{
+		if((height * screen_width / width) <= screen_height)
+		{
+			nx_size = screen_width;
+			ny_size = height * screen_width / width;
+		}
+		else
 		{
-			t = i->width;
-			i->width = i->height;
-			i->height = t;
+			nx_size = width * screen_height / height;
+			ny_size = screen_height;
 		}
 	}
+	*nx = nx_size;
+	*ny = ny_size;
 }
 
+struct transform
+{
+	int shrink, enlarge, cal, iaspect, rotation;
+	int widthonly, heightonly;
+	double zoom;
+};
 
-static inline void do_enlarge(struct image *i, int screen_width, int screen_height, int ignoreaspect, int widthonly, int heightonly)
+/* the transformations every image starts with, from the options */
+static void transform_init(struct transform *t, int x_size, int y_size, int screen_width, int screen_height)
 {
-	if(((i->width > screen_width) || (i->height > screen_height)) && (!ignoreaspect))
-		return;
-	if((i->width < screen_width) || (i->height < screen_height))
+	t->shrink = opt_shrink;
+	t->enlarge = opt_enlarge;
+	t->cal = opt_shrink >= 2 ? opt_shrink - 1 : 0;
+	t->iaspect = opt_ignore_aspect;
+	t->rotation = 0;
+	t->widthonly = opt_widthonly;
+	t->heightonly = opt_heightonly;
+	t->zoom = 1;
+
+	if (opt_smartfit>=0)
 	{
-		int xsize = i->width, ysize = i->height;
-		unsigned char * image, * alpha = NULL;
+		t->shrink = 1;
+		t->enlarge = 1;
 
-		if(ignoreaspect)
+		// Check if screen aspect ratio is larger than image aspect ratio
+		// screen_width/screen_height > x_size/y_size
+		if (screen_width*y_size > x_size*screen_height)
 		{
-			if(i->width < screen_width)
-				xsize = screen_width;
-			if(i->height < screen_height)
-				ysize = screen_height;
-
-			goto have_sizes;
+			if (opt_smartfit>100-100*x_size*screen_height/(y_size*screen_width))
+			{
+				t->widthonly = 1;
+				t->heightonly = 0;
+			}
 		}
-
-		if(widthonly) {
-			xsize = screen_width;
-			ysize = i->height * screen_width / i->width;
-			goto have_sizes;
+		else
+		{
+			if (opt_smartfit>100-100*y_size*screen_width/(x_size*screen_height))
+			{
+				t->widthonly = 0;
+				t->heightonly = 1;
+			}
 		}
+	}
+}
 
-		if(heightonly) {
-			xsize = i->width * screen_height / i->height;
-			ysize = screen_height;
-			goto have_sizes;
-		}
+/*
+ * Where the picture ends up: rotated, zoomed, then fitted to the screen.
+ * Only the final size is worked out here; unless the picture is shown as
+ * it is, the image keeps no pixels and fb_display() samples what is
+ * visible straight from the decoded picture in one pass, or from its
+ * tiles where the overview of a tiled one would be too coarse.
+ */
+static void transform_apply(struct image *i, const struct picture *p, const struct transform *t, int screen_width, int screen_height)
+{
+	int width = p->tiles ? p->tiles->width : p->width;
+	int height = p->tiles ? p->tiles->height : p->height;
+	int w = width, h = height, nx, ny, filter = 0;
 
-		if((i->height * screen_width / i->width) <= screen_height)
-		{
-			xsize = screen_width;
-			ysize = i->height * screen_width / i->width;
-			goto have_sizes;
-		}
+	memset(i, 0, sizeof(*i));
+	if(t->rotation & 1)
+	{
+		w = height;
+		h = width;
+	}
 
-		if((i->width * screen_height / i->height) <= screen_width)
-		{
-			xsize = i->width * screen_height / i->height;
-			ysize = screen_height;
-			goto have_sizes;
-		}
-		return;
-have_sizes:
-		image = simple_resize(i->rgb, i->width, i->height, xsize, ysize);
-		if(i->alpha)
-			alpha = alpha_resize(i->alpha, i->width, i->height, xsize, ysize);
+	if(t->zoom > 1 && (w > width / t->zoom || h > height / t->zoom))
+	{
+		fit_size(w, h, width / t->zoom, height / t->zoom, 0, 0, 0, &w, &h);
+		filter = t->cal;
+	}
+	if(t->zoom < 1 && enlarge_size(w, h, width / t->zoom, height / t->zoom, 0, 0, 0, &nx, &ny))
+	{
+		w = nx;
+		h = ny;
+		filter = t->cal;
+	}
+
+	if(t->shrink && (w > screen_width || h > screen_height))
+	{
+		fit_size(w, h, screen_width, screen_height, t->iaspect, t->widthonly, t->heightonly, &w, &h);
+		filter = t->cal;
+	}
+	if(t->enlarge && enlarge_size(w, h, screen_width, screen_height, t->iaspect, t->widthonly, t->heightonly, &nx, &ny))
+	{
+		w = nx;
+		h = ny;
+		filter = t->cal;
+	}
 
-		if(i->do_free)
+	i->width = w;
+	i->height = h;
+	if(!t->rotation && w == width && h == height)
+	{
+		/* a tiled picture is only shown at full size from its tiles */
+		if(p->tiles)
 		{
-			free(i->alpha);
-			free(i->rgb);
+			i->tiles = p->tiles;
+			return;
 		}
+		i->rgb = p->rgb;
+		i->alpha = p->alpha;
+		return;
+	}
+	i->rotation = t->rotation;
+	i->filter = filter;
 
-		i->rgb = image;
-		i->alpha = alpha;
-		i->do_free = 1;
-		i->width = xsize;
-		i->height = ysize;
+	/* finer than the overview: from the smallest level of tiles that is not */
+	if(t->rotation & 1)
+	{
+		nx = h;
+		ny = w;
+	}
+	else
+	{
+		nx = w;
+		ny = h;
+	}
+	if(p->tiles && (nx > p->width || ny > p->height))
+	{
+		int n = p->tiles->nlevels - 1;
+
+		while(n && (p->tiles->level[n].width < nx || p->tiles->level[n].height < ny))
+			n--;
+		i->src_tiles = p->tiles;
+		i->src_level = n;
+		i->src_width = p->tiles->level[n].width;
+		i->src_height = p->tiles->level[n].height;
+		return;
 	}
+	i->src_rgb = p->rgb;
+	i->src_alpha = p->alpha;
+	i->src_width = p->width;
+	i->src_height = p->height;
 }
 
+/*
+ * The picture halved again and again, each level made from the one
+ * above the first time it is wanted. A filtered image is sampled from
+ * the smallest level not smaller than it, so that zooming out costs in
+ * proportion to the image rather than to the whole picture. Nearest
+ * neighbour sampling only reads the pixels it keeps and does without.
+ */
+#define LEVELS	16
 
-static inline void do_fit_to_screen(struct image *i, int screen_width, int screen_height, int ignoreaspect, int widthonly, int heightonly, int cal)
+struct level
 {
-	if((i->width > screen_width) || (i->height > screen_height))
+	int width, height;
+	unsigned char *rgb, *alpha;
+};
+
+static void levels_free(struct level *levels)
+{
+	int n;
+
+	for(n = 0; n < LEVELS; n++)
 	{
-		unsigned char * new_image, * new_alpha = NULL;
-		int nx_size = i->width, ny_size = i->height;
+		free(levels[n].rgb);
+		free(levels[n].alpha);
+	}
+	memset(levels, 0, LEVELS * sizeof(*levels));
+}
 
-		if(ignoreaspect)
-		{
-			if(i->width > screen_width)
-				nx_size = screen_width;
-			if(i->height > screen_height)
-				ny_size = screen_height;
-		}
-		else if(widthonly) {
-			nx_size = screen_width;
-			ny_size = i->height * screen_width / i->width;
-		}
-		else if(heightonly) {
-			nx_size = i->width * screen_height / i->height;
-			ny_size = screen_height;
-		}
-		else
+static void use_level(struct level *levels, const struct picture *p, struct image *i)
+{
+	const unsigned char *rgb = p->rgb, *alpha = p->alpha;
+	int w = p->width, h = p->height, n;
+	int iw = i->rotation & 1 ? i->height : i->width;
+	int ih = i->rotation & 1 ? i->width : i->height;
+
+	if(!i->src_rgb || !i->filter)
+		return;
+	for(n = 0; n < LEVELS && w / 2 >= iw && h / 2 >= ih; n++)
+	{
+		struct level *l = &levels[n];
+
+		if(!l->rgb)
 		{
-			if((i->height * screen_width / i->width) <= screen_height)
-			{
-				nx_size = screen_width;
-				ny_size = i->height * screen_width / i->width;
-			}
-			else
+			l->width = w / 2;
+			l->height = h / 2;
+			l->rgb = halve(rgb, w, h, 3);
+			if(l->rgb && alpha && !(l->alpha = halve(alpha, w, h, 1)))
 			{
-				nx_size = i->width * screen_height / i->height;
-				ny_size = screen_height;
+				free(l->rgb);
+				l->rgb = NULL;
 			}
+			if(!l->rgb)
+				break;
 		}
+		rgb = l->rgb;
+		alpha = l->alpha;
+		w = l->width;
+		h = l->height;
+	}
+	i->src_rgb = rgb;
+	i->src_alpha = alpha;
+	i->src_width = w;
+	i->src_height = h;
+}
 
-		if(cal)
-			new_image = color_average_resize(i->rgb, i->width, i->height, nx_size, ny_size);
-		else
-			new_image = simple_resize(i->rgb, i->width, i->height, nx_size, ny_size);
-
-		if(i->alpha)
-			new_alpha = alpha_resize(i->alpha, i->width, i->height, nx_size, ny_size);
+/*
+ * Painting a picture on screen as it is decoded: every PAINT_INTERVAL
+ * milliseconds the rows decoded since the last paint are sampled into
+ * the picture's initial image and drawn, leaving a few rows of margin
+ * for the filter taps that reach rows not decoded yet.
+ */
+#define PAINT_INTERVAL	40
 
-		if(i->do_free)
-		{
-			free(i->alpha);
-			free(i->rgb);
-		}
+struct painter
+{
+	struct picture *p;
+	struct image img;
+	int x_pan, y_pan, x_offs, y_offs;
+	int lo, hi;	/* decoded rows not painted yet */
+	int valid;	/* rows decoded at least once */
+	struct timeval last;
+};
+
+static void painter_init(struct painter *pt, struct picture *p, const struct transform *t, int screen_width, int screen_height)
+{
+	struct image *i = &pt->img;
 
-		i->rgb = new_image;
-		i->alpha = new_alpha;
-		i->do_free = 1;
-		i->width = nx_size;
-		i->height = ny_size;
+	memset(pt, 0, sizeof(*pt));
+	pt->p = p;
+	transform_apply(i, p, t, screen_width, screen_height);
+	if(i->rgb)
+	{
+		i->src_rgb = i->rgb;
+		i->src_width = p->width;
+		i->src_height = p->height;
+		i->rgb = NULL;
 	}
-}
 
+	if(opt_smartfit >= 0 && i->width > screen_width)
+		pt->x_pan = (i->width - screen_width) / 2;
+	if(opt_smartfit >= 0 && i->height > screen_height)
+		pt->y_pan = (i->height - screen_height) / 2;
+	if(i->width < screen_width)
+		pt->x_offs = (screen_width - i->width) / 2;
+	if(i->height < screen_height)
+		pt->y_offs = (screen_height - i->height) / 2;
+	gettimeofday(&pt->last, NULL);
+}
 
-int show_image(char *filename)
+static void paint_progress(void *ctx, int y0, int y1)
 {
-	int (*load)(char *, unsigned char *, unsigned char **, int, int);
-
-	unsigned char * image = NULL;
-	unsigned char * alpha = NULL;
+	struct painter *pt = (struct painter*)ctx;
+	long long h = pt->img.height, sh = pt->p->height;
+	struct timeval now;
+
+	if(y0 < pt->lo)
+		pt->lo = y0;
+	if(y1 > pt->hi)
+		pt->hi = y1;
+	if(y1 > pt->valid)
+		pt->valid = y1;
+
+	gettimeofday(&now, NULL);
+	if((now.tv_sec - pt->last.tv_sec) * 1000 + (now.tv_usec - pt->last.tv_usec) / 1000 < PAINT_INTERVAL)
+		return;
+	pt->last = now;
 
-	int c, ret;
-	int x_size, y_size, screen_width, screen_height;
-	int x_pan, y_pan, x_offs, y_offs, refresh = 1;
-	int delay = opt_delay, retransform = 1, noshow = 0;
+	y0 = (pt->lo - 2) * h / sh - 2;
+	y1 = pt->valid == sh ? h : (pt->valid - 2) * h / sh - 2;
+	if(y0 < 0)
+		y0 = 0;
+	if(y0 >= y1)
+		return;
+	pt->img.src_alpha = opt_alpha ? pt->p->alpha : NULL;
+	fb_display_rows(&fb, &pt->img, pt->x_pan, pt->y_pan, pt->x_offs, pt->y_offs, y0, y1);
 
-	int transform_shrink = opt_shrink, transform_enlarge = opt_enlarge;
-	int transform_cal = (opt_shrink == 2), transform_iaspect = opt_ignore_aspect;
-	int transform_rotation = 0;
-	int transform_widthonly = opt_widthonly, transform_heightonly = opt_heightonly;
+	/* the rows just painted, short of the margin, are done with */
+	y1 = (y1 + 2) * sh / h;
+	if(y1 > pt->lo)
+		pt->lo = y1 < pt->hi ? y1 : pt->hi;
+}
 
-	double zoom = 1;
+/*
+ * Decode a file and apply the initial transformations. With scale set,
+ * a file that is going to be shrunk to the screen anyway is decoded at
+ * a reduced size if its loader can (JPEG DCT scaling). With paint set,
+ * it is shown as it is decoded.
+ */
+static void load_picture(char *filename, struct picture *p, int scale, int paint)
+{
+	const struct fh_loader *l;
+	unsigned char hdr[FH_HEADER_LEN];
+	int len, screen_width, screen_height;
+	struct transform t;
+	FILE *fh;
 
-	struct image i;
+	memset(p, 0, sizeof(*p));
 
-#ifdef FBV_SUPPORT_PNG
-	if(fh_png_id(filename))
-	if(fh_png_getsize(filename, &x_size, &y_size) == FH_ERROR_OK)
+	if(!(fh = fopen(filename, "rb")))
+	{
+		p->error = "Unable to access file or file format unknown.";
+		return;
+	}
+	if(!(l = fh_identify(fh, hdr, &len, &p->width, &p->height)))
 	{
-		load = fh_png_load;
-		goto identified;
+		p->error = "Unable to access file or file format unknown.";
+		goto out;
 	}
-#endif
 
-#ifdef FBV_SUPPORT_JPEG
-	if(fh_jpeg_id(filename))
-	if(fh_jpeg_getsize(filename, &x_size, &y_size) == FH_ERROR_OK)
+	p->orig_width = p->width;
+	p->orig_height = p->height;
+
+	getCurrentRes(&fb, &screen_width, &screen_height);
+	transform_init(&t, p->width, p->height, screen_width, screen_height);
+
+	if(scale && t.shrink && (p->width > screen_width || p->height > screen_height))
 	{
-		load = fh_jpeg_load;
-		goto identified;
+		int nx, ny;
+
+		fit_size(p->width, p->height, screen_width, screen_height, t.iaspect, t.widthonly, t.heightonly, &nx, &ny);
+		if(l->getsize(fh, hdr, len, &p->width, &p->height, nx, ny) != FH_ERROR_OK)
+		{
+			p->error = "Unable to access file or file format unknown.";
+			goto out;
+		}
 	}
-#endif
 
-#ifdef FBV_SUPPORT_BMP
-	if(fh_bmp_id(filename))
-	if(fh_bmp_getsize(filename, &x_size, &y_size) == FH_ERROR_OK)
+	/* too big to keep whole: tiles of the full size and an overview */
+	if((size_t)p->width * p->height * 4 > (size_t)opt_tile_mem << 20)
 	{
-		load = fh_bmp_load;
-		goto identified;
+		if(l->getsize(fh, hdr, len, &p->width, &p->height, 0, 0) != FH_ERROR_OK ||
+		   tiles_load(p, l, fh, opt_alpha) != FH_ERROR_OK)
+		{
+			p->error = "Unable to decode the image into tiles.";
+			goto out;
+		}
 	}
-#endif
-	fprintf(stderr, "%s: Unable to access file or file format unknown.\n", filename);
-	return(1);
+	else
+	{
+		struct painter pt;
+		int ret;
 
-identified:
+		if(!(p->rgb = (unsigned char*)malloc((size_t)p->width * p->height * 3)))
+		{
+			p->error = "Out of memory.";
+			goto out;
+		}
 
-	if(!(image = (unsigned char*)malloc(x_size * y_size * 3)))
+		if(paint)
+			painter_init(&pt, p, &t, screen_width, screen_height);
+		ret = l->load(fh, p->rgb, &p->alpha, p->width, p->height, paint ? paint_progress : NULL, &pt);
+		if(paint)
+			fb_image_invalidate(&pt.img);
+		if(ret != FH_ERROR_OK)
+		{
+			p->error = "Image data is corrupt?";
+			goto out;
+		}
+	}
+
+	if(!opt_alpha)
 	{
-		fprintf(stderr, "%s: Out of memory.\n", filename);
-		goto error;
+		free(p->alpha);
+		p->alpha = NULL;
 	}
 
-	if(load(filename, image, &alpha, x_size, y_size) != FH_ERROR_OK)
+	transform_apply(&p->first, p, &t, screen_width, screen_height);
+out:
+	fclose(fh);
+}
+
+/* may run on a prefetch thread; only the main one paints */
+static void prepare_picture(char *filename, struct picture *p)
+{
+	load_picture(filename, p, 1, opt_progressive && pthread_equal(pthread_self(), main_thread));
+}
+
+static void release_picture(struct picture *p)
+{
+	if(p->first.do_free)
 	{
-		fprintf(stderr, "%s: Image data is corrupt?\n", filename);
-		goto error;
+		free(p->first.rgb);
+		free(p->first.alpha);
 	}
+	free(p->rgb);
+	free(p->alpha);
+	tiles_free(p->tiles);
+}
 
-	if(!opt_alpha)
+/* what prepare_picture() will keep of a file, from its header alone */
+static size_t estimate_picture(char *filename)
+{
+	const struct fh_loader *l;
+	unsigned char hdr[FH_HEADER_LEN];
+	int len, width, height, screen_width, screen_height;
+	struct transform t;
+	size_t n = 0;
+	FILE *fh;
+
+	if(!(fh = fopen(filename, "rb")))
+		return 0;
+	if(!(l = fh_identify(fh, hdr, &len, &width, &height)))
+		goto out;
+
+	/* decoded smaller to fit, as load_picture() does */
+	getCurrentRes(&fb, &screen_width, &screen_height);
+	transform_init(&t, width, height, screen_width, screen_height);
+	if(t.shrink && (width > screen_width || height > screen_height))
 	{
-		free(alpha);
-		alpha = NULL;
+		int nx, ny;
+
+		fit_size(width, height, screen_width, screen_height, t.iaspect, t.widthonly, t.heightonly, &nx, &ny);
+		if(l->getsize(fh, hdr, len, &width, &height, nx, ny) != FH_ERROR_OK)
+			goto out;
 	}
 
-	if(getCurrentRes(&screen_width, &screen_height))
-		goto error;
-	i.do_free = 0;
+	/* with alpha, at most; a tiled one keeps only its overview */
+	n = (size_t)width * height * 4;
+	if(n > (size_t)opt_tile_mem << 20)
+		n = (size_t)opt_tile_mem << 20;
+out:
+	fclose(fh);
+	return n;
+}
 
-	if (opt_smartfit>=0)
+/* a thumbnail of a file, no bigger than size x size, alpha over black */
+static int make_thumb(char *filename, int size, struct thumb *th)
+{
+	const struct fh_loader *l;
+	unsigned char hdr[FH_HEADER_LEN];
+	struct picture p;
+	int len, nx, ny, ret = -1;
+	size_t n;
+	FILE *fh;
+
+	if(!(fh = fopen(filename, "rb")))
+		return -1;
+	memset(&p, 0, sizeof(p));
+	if(!(l = fh_identify(fh, hdr, &len, &p.width, &p.height)))
+		goto out;
+
+	nx = p.width;
+	ny = p.height;
+	if(nx > size || ny > size)
+		fit_size(p.width, p.height, size, size, 0, 0, 0, &nx, &ny);
+	if(nx < 1)
+		nx = 1;
+	if(ny < 1)
+		ny = 1;
+	if(l->getsize(fh, hdr, len, &p.width, &p.height, nx, ny) != FH_ERROR_OK)
+		goto out;
+
+	if((size_t)p.width * p.height * 4 > (size_t)opt_tile_mem << 20)
 	{
-		transform_shrink = 1;
-		transform_enlarge = 1;
-
-		// Check if screen aspect ratio is larger than image aspect ratio
-		// screen_width/screen_height > x_size/y_size
-		if (screen_width*y_size > x_size*screen_height)
-		{
-			if (opt_smartfit>100-100*x_size*screen_height/(y_size*screen_width))
-			{
-				transform_widthonly = 1;
-				transform_heightonly = 0;
-			}
-		}
-		else
-		{
-			if (opt_smartfit>100-100*y_size*screen_width/(x_size*screen_height))
-			{
-				transform_widthonly = 0;
-				transform_heightonly = 1;
-			}
-		}
+		/* an overview twice the size is plenty, and needs no tiles */
+		if(l->getsize(fh, hdr, len, &p.width, &p.height, 0, 0) != FH_ERROR_OK ||
+		   tiles_overview(&p, l, fh, 2 * size, 1) != FH_ERROR_OK)
+			goto out;
 	}
+	else if(!(p.rgb = (unsigned char*)malloc((size_t)p.width * p.height * 3)) ||
+		l->load(fh, p.rgb, &p.alpha, p.width, p.height, NULL, NULL) != FH_ERROR_OK)
+		goto out;
+
+	if(p.alpha)
+		for(n = 0; n < (size_t)p.width * p.height * 3; n++)
+			p.rgb[n] = p.rgb[n] * p.alpha[n / 3] / 255;
+	th->width = nx;
+	th->height = ny;
+	if((th->rgb = resample(p.rgb, p.width, p.height, nx, ny, 3, RESAMPLE_SMOOTH)))
+		ret = 0;
+out:
+	free(p.rgb);
+	free(p.alpha);
+	fclose(fh);
+	return ret;
+}
+
+int show_image(int index, char *filename)
+{
+	struct picture own, full, *p;
+
+	int c, ret = 1;
+	int screen_width, screen_height;
+	int x_pan, y_pan, x_offs, y_offs, refresh = 1;
+	int delay = opt_delay, retransform = 1, noshow = 0, first = 1;
+
+	struct transform t;
+	struct image i;
+	struct level levels[LEVELS];
 
+	memset(&i, 0, sizeof(i));
+	memset(levels, 0, sizeof(levels));
 
+	if(!(p = prefetch_get(index)))
+	{
+		prepare_picture(filename, &own);
+		p = &own;
+	}
+	if(p->error)
+	{
+		fprintf(stderr, "%s: %s\n", filename, p->error);
+		goto error;
+	}
 
+	if(getCurrentRes(&fb, &screen_width, &screen_height))
+		goto error;
+	transform_init(&t, p->orig_width, p->orig_height, screen_width, screen_height);
 
 	while(1)
 	{
 		if(retransform)
 		{
+			fb_image_invalidate(&i);
 			if(i.do_free)
 			{
 				free(i.rgb);
 				free(i.alpha);
 			}
-			i.width = x_size;
-			i.height = y_size;
-			i.rgb = image;
-			i.alpha = alpha;
-			i.do_free = 0;
-
-			if(transform_rotation)
-				do_rotate(&i, transform_rotation);
 
-			if(zoom > 1)
-				do_fit_to_screen(&i, x_size / zoom, y_size / zoom, 0, 0, 0, 0);
-			if(zoom < 1)
-				do_enlarge(&i, x_size / zoom, y_size / zoom, 0, 0, 0);
-
-			if(transform_shrink)
-				do_fit_to_screen(&i, screen_width, screen_height, transform_iaspect, transform_widthonly, transform_heightonly, transform_cal);
-
-			if(transform_enlarge)
-				do_enlarge(&i, screen_width, screen_height, transform_iaspect, transform_widthonly, transform_heightonly);
+			/* the prepared picture is already transformed the initial way */
+			if(first)
+			{
+				i = p->first;
+				i.do_free = 0;
+				first = 0;
+			}
+			else
+			{
+				/* a reduced decode only suits the initial fit; go back to the file */
+				if(!p->tiles && (p->width != p->orig_width || p->height != p->orig_height))
+				{
+					load_picture(filename, &full, 0, 0);
+					if(full.error)
+						release_picture(&full);
+					else
+					{
+						if(p == &own)
+							release_picture(&own);
+						else
+							prefetch_put(p);
+						p = &full;
+					}
+				}
+				transform_apply(&i, p, &t, screen_width, screen_height);
+				use_level(levels, p, &i);
+			}
 
 			x_pan = y_pan = 0;
 			if (opt_smartfit>=0)
@@ -390,21 +732,21 @@ identified:
 			if(opt_image_info) {
 				printf("fbv - The Framebuffer Viewer\n");
 				printf("%s\n", imagename ? imagename : filename);
-				printf("%d x %d\n", x_size, y_size);
+				printf("%d x %d\n", p->orig_width, p->orig_height);
 				printf(inline_status,
-					opener[transform_shrink],
-					closer[transform_shrink],
-					opener[transform_cal],
-					closer[transform_cal],
-					opener[transform_enlarge],
-					closer[transform_enlarge],
-					opener[transform_widthonly],
-					closer[transform_widthonly],
-					opener[transform_heightonly],
-					closer[transform_heightonly],
-					opener[transform_iaspect],
-					closer[transform_iaspect],
-					1 / zoom
+					opener[t.shrink],
+					closer[t.shrink],
+					opener[t.cal],
+					closer[t.cal],
+					opener[t.enlarge],
+					closer[t.enlarge],
+					opener[t.widthonly],
+					closer[t.widthonly],
+					opener[t.heightonly],
+					closer[t.heightonly],
+					opener[t.iaspect],
+					closer[t.iaspect],
+					1 / t.zoom
 				);
 
 				if (isatty(fileno(stdout)))
@@ -423,7 +765,7 @@ identified:
 			else
 				y_offs = 0;
 
-			if(fb_display(i.rgb, i.alpha, i.width, i.height, x_pan, y_pan, x_offs, y_offs))
+			if(fb_display(&fb, &i, x_pan, y_pan, x_offs, y_offs))
 				goto error;
 			refresh = 0;
 		}
@@ -500,63 +842,63 @@ identified:
 					refresh = 1;
 					break;
 				case 'f':
-					transform_shrink = !transform_shrink;
+					t.shrink = !t.shrink;
 					retransform = 1;
 					break;
 				case 'e':
-					transform_enlarge = !transform_enlarge;
+					t.enlarge = !t.enlarge;
 					retransform = 1;
 					break;
 				case 'l':
-					transform_widthonly = !transform_widthonly;
-					transform_heightonly = 0;
+					t.widthonly = !t.widthonly;
+					t.heightonly = 0;
 					retransform = 1;
 					break;
 				case 't':
-					transform_widthonly = 0;
-					transform_heightonly = !transform_heightonly;
+					t.widthonly = 0;
+					t.heightonly = !t.heightonly;
 					retransform = 1;
 					break;
 				case 'k':
-					transform_cal = !transform_cal;
+					t.cal = (t.cal + 1) % 3;
 					retransform = 1;
 					break;
 				case 'i':
-					transform_iaspect = !transform_iaspect;
+					t.iaspect = !t.iaspect;
 					retransform = 1;
 					break;
 				case '0':
 				case '+':
 				case '-':
-					transform_cal = 0;
-					transform_iaspect = 0;
-					transform_enlarge = 0;
-					transform_shrink = 0;
-					transform_widthonly = 0;
-					transform_heightonly = 0;
-					zoom = c == '0' ? 1 : c == '+' ? zoom / 1.5 : zoom * 1.5;
+					t.cal = 0;
+					t.iaspect = 0;
+					t.enlarge = 0;
+					t.shrink = 0;
+					t.widthonly = 0;
+					t.heightonly = 0;
+					t.zoom = c == '0' ? 1 : c == '+' ? t.zoom / 1.5 : t.zoom * 1.5;
 					retransform = 1;
 					break;
 				case 'p':
-					transform_cal = 0;
-					transform_iaspect = 0;
-					transform_enlarge = 0;
-					transform_shrink = 0;
-					transform_widthonly = 0;
-					transform_heightonly = 0;
-					zoom = 1;
+					t.cal = 0;
+					t.iaspect = 0;
+					t.enlarge = 0;
+					t.shrink = 0;
+					t.widthonly = 0;
+					t.heightonly = 0;
+					t.zoom = 1;
 					retransform = 1;
 					break;
 				case 'n':
-					transform_rotation -= 1;
-					if(transform_rotation < 0)
-						transform_rotation += 4;
+					t.rotation -= 1;
+					if(t.rotation < 0)
+						t.rotation += 4;
 					retransform = 1;
 					break;
 				case 'm':
-					transform_rotation += 1;
-					if(transform_rotation > 3)
-						transform_rotation -= 4;
+					t.rotation += 1;
+					if(t.rotation > 3)
+						t.rotation -= 4;
 					retransform = 1;
 					break;
 				case 'h': case '\033':
@@ -585,16 +927,178 @@ done:
 	}
 
 error:
-	free(image);
-	free(alpha);
+	fb_image_invalidate(&i);
 	if(i.do_free)
 	{
 		free(i.rgb);
 		free(i.alpha);
 	}
+	levels_free(levels);
+	if(p == &own || p == &full)
+		release_picture(p);
+	else
+		prefetch_put(p);
 	return ret;
 }
 
+/*
+ * The grid: a page of thumbnails of the files, filled in as they are
+ * made, the current one framed. Returns the file picked, or -1 to quit.
+ */
+#define GRID_GAP	16
+
+static void grid_cell(int cell, int x0, int y0, int cols, int index, int *x, int *y)
+{
+	*x = x0 + index % cols * cell + GRID_GAP / 2;
+	*y = y0 + index / cols * cell + GRID_GAP / 2;
+}
+
+/* a plain square of THUMB_SIZE, or a frame around it */
+static void grid_box(int x, int y, unsigned char value, int frame)
+{
+	static unsigned char row[(THUMB_SIZE + GRID_GAP) * 3];
+	int side = THUMB_SIZE + 8;
+
+	memset(row, value, sizeof(row));
+	if(!frame)
+	{
+		fb_draw_rgb(&fb, row, 0, THUMB_SIZE, THUMB_SIZE, x, y);
+		return;
+	}
+	x -= 4;
+	y -= 4;
+	fb_draw_rgb(&fb, row, 0, side, 2, x, y);
+	fb_draw_rgb(&fb, row, 0, side, 2, x, y + side - 2);
+	fb_draw_rgb(&fb, row, 0, 2, side, x, y);
+	fb_draw_rgb(&fb, row, 0, 2, side, x + side - 2, y);
+}
+
+static int show_grid(char **files, int count, int current)
+{
+	int screen_width, screen_height, cell = THUMB_SIZE + GRID_GAP;
+	int cols, rows, per_page, first = -1, framed = -1;
+	int x0, y0, x, y, i, c, n, pending;
+	struct thumb th;
+	char *drawn;
+	char buf[64];
+	fd_set fds;
+
+	getCurrentRes(&fb, &screen_width, &screen_height);
+	cols = screen_width / cell;
+	rows = screen_height / cell;
+	if(cols < 1)
+		cols = 1;
+	if(rows < 1)
+		rows = 1;
+	per_page = cols * rows;
+	x0 = screen_width > cols * cell ? (screen_width - cols * cell) / 2 : 0;
+	y0 = screen_height > rows * cell ? (screen_height - rows * cell) / 2 : 0;
+	if(!(drawn = (char*)malloc(per_page)))
+		return -1;
+
+	if(opt_clear)
+	{
+		printf("\033[H\033[J");
+		fflush(stdout);
+	}
+
+	while(1)
+	{
+		if(current / per_page * per_page != first)
+		{
+			first = current / per_page * per_page;
+			thumbs_want(first, per_page);
+			memset(drawn, 0, per_page);
+			fb_clear_screen(&fb);
+			framed = -1;
+		}
+
+		/* whatever is done since the last time round */
+		pending = 0;
+		for(i = 0; i < per_page && first + i < count; i++)
+		{
+			if(drawn[i])
+				continue;
+			grid_cell(cell, x0, y0, cols, i, &x, &y);
+			if((n = thumbs_get(first + i, &th)) > 0)
+				fb_draw_rgb(&fb, th.rgb, th.width * 3, th.width, th.height,
+					x + (THUMB_SIZE - th.width) / 2, y + (THUMB_SIZE - th.height) / 2);
+			else if(n < 0)
+				grid_box(x, y, 48, 0);
+			else
+				pending++;
+			drawn[i] = n != 0;
+		}
+		if(framed != current)
+		{
+			if(framed >= 0)
+			{
+				grid_cell(cell, x0, y0, cols, framed - first, &x, &y);
+				grid_box(x, y, 0, 1);
+			}
+			grid_cell(cell, x0, y0, cols, current - first, &x, &y);
+			grid_box(x, y, 255, 1);
+			framed = current;
+		}
+
+		/* nothing to pick with: show the page, then leave */
+		if(!isatty(fileno(stdin)) && !pending)
+		{
+			free(drawn);
+			return -1;
+		}
+
+		FD_ZERO(&fds);
+		FD_SET(thumbs_fd(), &fds);
+		if(isatty(fileno(stdin)))
+			FD_SET(0, &fds);
+		if(select(thumbs_fd() + 1, &fds, NULL, NULL, NULL) <= 0)
+			continue;
+		if(FD_ISSET(thumbs_fd(), &fds))
+			while(read(thumbs_fd(), buf, sizeof(buf)) > 0)
+				;
+		if(!FD_ISSET(0, &fds))
+			continue;
+
+		c = getchar();
+		switch(c)
+		{
+			case EOF:
+			case 'q':
+				free(drawn);
+				return -1;
+			case ' ': case 10: case 13:
+				free(drawn);
+				return current;
+			case 'r':
+				first = -1;
+				break;
+			case 'a': case 'D':
+				current--;
+				break;
+			case 'd': case 'C':
+				current++;
+				break;
+			case 'w': case 'A':
+				current -= cols;
+				break;
+			case 'x': case 'B':
+				current += cols;
+				break;
+			case '<': case ',':
+				current -= per_page;
+				break;
+			case '>': case '.':
+				current += per_page;
+				break;
+		}
+		if(current >= count)
+			current = count - 1;
+		if(current < 0)
+			current = 0;
+	}
+}
+
 void help(char *name)
 {
 	printf("Usage: %s [options] image1 image2 image3 ...\n\n"
@@ -605,13 +1109,19 @@ void help(char *name)
 		   "  -u, --donthide      Do not hide the cursor before and after displaying the image\n"
 		   "  -i, --noinfo        Supress image information\n"
 		   "  -f, --shrink        Shrink (using a simple resizing routine) the image to fit onto screen if necessary\n"
-		   "  -k, --colorshrink   Shrink (using a 'color average' resizing routine) the image to fit onto screen if necessary\n"
+		   "  -k, --colorshrink   Shrink (using a smooth area/bilinear resizing routine) the image to fit onto screen if necessary\n"
+		   "  -K, --sharpshrink   Shrink (using a sharper Lanczos resizing routine) the image to fit onto screen if necessary\n"
 		   "  -e, --enlarge       Enlarge the image to fit the whole screen if necessary\n"
 		   "  -l, --widthonly     Fit the image horizontally\n"
 		   "  -t, --heightonly    Fit the image vertically\n"
 		   "  -x <percent>, --smartfit <percent>  Show image by covering the whole screen if less than <percent>\% is out of screen\n"
 		   "  -r, --ignore-aspect Ignore the image aspect while resizing\n"
-		   "  -s <delay>, --delay <d>  Slideshow, 'delay' is the slideshow delay in tenths of seconds.\n\n"
+		   "  -s <delay>, --delay <d>  Slideshow, 'delay' is the slideshow delay in tenths of seconds.\n"
+		   "  -P <n>, --prefetch <n>  Decode the next n images in the background (default 2, 0 disables)\n"
+		   "  -M <MiB>, --prefetch-mem <MiB>  Memory for decoded images kept around (default 256)\n"
+		   "  -T <MiB>, --tile-mem <MiB>  Decode images bigger than this into tiles on disk (default 128)\n"
+		   "  -p, --progressive   Paint images on screen while they are decoded\n"
+		   "  -g, --grid          Start with a grid of thumbnails of the images to pick from\n\n"
 		   "  -n imagename(s)     Image name(s) shown in help"
 		   "Input keys:\n"
 		   " r          : Redraw the image\n"
@@ -619,7 +1129,7 @@ void help(char *name)
 		   " > or .     : Next image\n"
 		   " a, d, w, x : Pan the image\n"
 		   " f          : Toggle resizing on/off\n"
-		   " k          : Toggle resizing quality\n"
+		   " k          : Cycle resizing quality (simple, smooth, sharp)\n"
 		   " e          : Toggle enlarging on/off\n"
 		   " l          : Toggle fitting the image horizontally\n"
 		   " t          : Toggle fitting the image vertically\n"
@@ -655,6 +1165,7 @@ int main(int argc, char **argv)
 		{"noinfo",        no_argument,  0, 'i'},
 		{"shrink",        no_argument,  0, 'f'},
 		{"colorshrink",   no_argument,  0, 'k'},
+		{"sharpshrink",   no_argument,  0, 'K'},
 		{"delay",         required_argument, 0, 's'},
 		{"enlarge",       no_argument,  0, 'e'},
 		{"widthonly",     no_argument,  0, 'l'},
@@ -662,6 +1173,11 @@ int main(int argc, char **argv)
 		{"smartfit",     required_argument,  0, 'x'},
 		{"ignore-aspect", no_argument,  0, 'r'},
 		{"imagename",     required_argument, 0, 'n'},
+		{"prefetch",      required_argument, 0, 'P'},
+		{"prefetch-mem",  required_argument, 0, 'M'},
+		{"tile-mem",      required_argument, 0, 'T'},
+		{"progressive",   no_argument,  0, 'p'},
+		{"grid",          no_argument,  0, 'g'},
 		{0, 0, 0, 0}
 	};
 	int c, i;
@@ -675,7 +1191,7 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	while((c = getopt_long_only(argc, argv, "hn:cauifks:eltxr", long_options, NULL)) != EOF)
+	while((c = getopt_long_only(argc, argv, "hn:cauifkKs:eltxrP:M:T:pg", long_options, NULL)) != EOF)
 	{
 		switch(c)
 		{
@@ -706,6 +1222,9 @@ int main(int argc, char **argv)
 			case 'k':
 				opt_shrink = 2;
 				break;
+			case 'K':
+				opt_shrink = 3;
+				break;
 			case 'e':
 				opt_enlarge = 1;
 				break;
@@ -721,6 +1240,21 @@ int main(int argc, char **argv)
 			case 'r':
 				opt_ignore_aspect = 1;
 				break;
+			case 'P':
+				opt_prefetch = atoi(optarg);
+				break;
+			case 'M':
+				opt_prefetch_mem = atoi(optarg);
+				break;
+			case 'T':
+				opt_tile_mem = atoi(optarg);
+				break;
+			case 'p':
+				opt_progressive = 1;
+				break;
+			case 'g':
+				opt_grid = 1;
+				break;
 		}
 	}
 
@@ -751,6 +1285,10 @@ int main(int argc, char **argv)
 	signal(SIGTERM, sighandler);
 	signal(SIGABRT, sighandler);
 
+	main_thread = pthread_self();
+	if(fb_open(&fb, NULL))
+		return 1;
+
 	vt_setup();
 
 	if(opt_hide_cursor)
@@ -761,20 +1299,47 @@ int main(int argc, char **argv)
 
 	setup_console(1);
 
+	prefetch_start(argv + optind, argc - optind, opt_prefetch,
+		(size_t)opt_prefetch_mem << 20, prepare_picture, release_picture, estimate_picture);
+
+	if(opt_grid)
+	{
+		/* one key at a time, so that select() sees the next one */
+		setvbuf(stdin, NULL, _IONBF, 0);
+		if(thumbs_start(argv + optind, argc - optind, make_thumb))
+			opt_grid = 0;
+	}
+
 	i = optind;
-	while(argv[i])
+	while(1)
 	{
-		imagename = (argc - optind == 1) ?
-			 nameopts : namestarts[i - optind];
-		int r = show_image(argv[i]);
-		if(r == 0)
+		if(opt_grid && (i = show_grid(argv + optind, argc - optind, i - optind)) < 0)
+			break;
+		if(opt_grid)
+			i += optind;
+		while(argv[i])
+		{
+			imagename = (argc - optind == 1) ?
+				 nameopts : namestarts[i - optind];
+			int r = show_image(i - optind, argv[i]);
+			if(r == 0)
+				break;
+			i += r;
+			if(i < optind)
+				i = optind;
+		}
+		/* back to the grid, at the image left */
+		if(!opt_grid)
 			break;
-		i += r;
-		if(i < optind)
-			i = optind;
+		if(!argv[i])
+			i--;
 	}
 
+	if(opt_grid)
+		thumbs_stop();
+	prefetch_stop();
 	setup_console(0);
+	fb_close(&fb);
 
 	if(opt_hide_cursor)
 	{
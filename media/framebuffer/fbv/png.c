@@ -1,55 +1,219 @@
 #include "config.h"
 
 #ifdef FBV_SUPPORT_PNG
-#include "fbv.h"
 #include <stdlib.h>
 #include <string.h>
-#include <png.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <png.h>
+#include "fbv.h"
 
 #define PNG_BYTES_TO_CHECK 4
 #ifndef min
 #define min(x,y) ((x) < (y) ? (x) : (y))
 #endif
 
-int fh_png_id(char *name)
+#define be32(p)	(((unsigned int)(p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3])
+
+static int fh_png_id(const unsigned char *id, int len)
 {
-	int fd;
-	char id[4];
-	fd = open(name, O_RDONLY);
-	if(fd==-1) return(0);
-	read(fd, id, 4);
-	close(fd);
+	if(len < 4) return(0);
 	if(id[1]=='P' && id[2]=='N' && id[3]=='G') return(1);
 	return(0);
 }
 
 
-int fh_png_load(char *name, unsigned char *buffer, unsigned char ** alpha,int x,int y)
+/* expand everything to 8 bit RGB or RGBA; whether it is RGBA */
+static int png_setup(png_structp png_ptr, png_infop info_ptr, int *number_passes)
+{
+	png_uint_32 width, height;
+	int bit_depth, color_type, interlace_type, trans = 0;
+
+	png_read_info(png_ptr, info_ptr);
+	png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, &interlace_type, NULL, NULL);
+	if (color_type == PNG_COLOR_TYPE_PALETTE) png_set_expand(png_ptr);
+	if (bit_depth < 8) png_set_packing(png_ptr);
+	if (color_type == PNG_COLOR_TYPE_GRAY || color_type== PNG_COLOR_TYPE_GRAY_ALPHA) png_set_gray_to_rgb(png_ptr);
+	if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+	{
+		trans = 1;
+		png_set_tRNS_to_alpha(png_ptr);
+	}
+
+	if(bit_depth == 16) png_set_strip_16(png_ptr);
+	*number_passes = png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+
+	return color_type == PNG_COLOR_TYPE_GRAY_ALPHA || color_type == PNG_COLOR_TYPE_RGB_ALPHA || trans;
+}
+
+/*
+ * The rows of a non interlaced file are inflated, unfiltered and
+ * expanded by libpng; whatever is done with each row after that is up
+ * to use(). On a machine with more than one CPU a big file is decoded
+ * on a second thread, at most ring rows ahead of the calling one, which
+ * goes on calling use(): painting and writing tiles stay where they
+ * were, but no longer wait for libpng.
+ */
+#define PNG_RING	32
+#define PNG_THREAD_MIN	(1 << 18)	/* pixels */
+
+typedef int (*png_use_fn)(void *ctx, int y, unsigned char *row);
+
+struct png_rows
 {
 	png_structp png_ptr;
 	png_infop info_ptr;
-	png_uint_32 width, height;
+	unsigned char *rows;	/* row y at rows + (y % ring) * stride */
+	size_t stride;
+	int ring, height;
+	png_use_fn use;		/* NULL if the rows are all there is to it */
+	void *ctx;
+
+	int threaded;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int decoded, used;	/* rows so far */
+	int failed, stop;
+};
+
+static void *png_decode(void *arg)
+{
+	struct png_rows *r = (struct png_rows*)arg;
+	int y;
+
+	if (setjmp(png_jmpbuf(r->png_ptr)))
+	{
+		pthread_mutex_lock(&r->lock);
+		r->failed = 1;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+		return NULL;
+	}
+	for (y = 0; y < r->height; y++)
+	{
+		unsigned char *row = r->rows + (size_t)(y % r->ring) * r->stride;
+
+		if (r->threaded)
+		{
+			int stop;
+
+			pthread_mutex_lock(&r->lock);
+			while (y - r->used >= r->ring && !r->stop)
+				pthread_cond_wait(&r->cond, &r->lock);
+			stop = r->stop;
+			pthread_mutex_unlock(&r->lock);
+			if (stop)
+				return NULL;
+		}
+		png_read_row(r->png_ptr, row, NULL);
+		if (r->threaded)
+		{
+			pthread_mutex_lock(&r->lock);
+			r->decoded = y + 1;
+			pthread_cond_broadcast(&r->cond);
+			pthread_mutex_unlock(&r->lock);
+		}
+		else if (r->use && r->use(r->ctx, y, row))
+		{
+			r->stop = 1;
+			return NULL;
+		}
+	}
+	png_read_end(r->png_ptr, r->info_ptr);
+	return NULL;
+}
+
+/*
+ * libpng errors go back to png_decode() from here on: the caller may
+ * only destroy png_ptr afterwards.
+ */
+static int png_read_rows(struct png_rows *r, int width)
+{
+	pthread_t thread;
+	int y, stop = 0;
+
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	r->decoded = r->used = r->failed = r->stop = 0;
+	r->threaded = r->use && (size_t)width * r->height >= PNG_THREAD_MIN &&
+		sysconf(_SC_NPROCESSORS_ONLN) > 1;
+	if (r->threaded && pthread_create(&thread, NULL, png_decode, r))
+		r->threaded = 0;
+
+	if (!r->threaded)
+		png_decode(r);
+	else
+	{
+		for (y = 0; y < r->height && !stop; y++)
+		{
+			pthread_mutex_lock(&r->lock);
+			while (r->decoded <= y && !r->failed)
+				pthread_cond_wait(&r->cond, &r->lock);
+			pthread_mutex_unlock(&r->lock);
+			if (r->decoded <= y)
+				break;
+
+			stop = r->use(r->ctx, y, r->rows + (size_t)(y % r->ring) * r->stride);
+
+			pthread_mutex_lock(&r->lock);
+			r->used = y + 1;
+			r->stop = stop;
+			pthread_cond_broadcast(&r->cond);
+			pthread_mutex_unlock(&r->lock);
+		}
+		pthread_join(thread, NULL);
+	}
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	return r->stop ? FH_ERROR_FILE : r->failed ? FH_ERROR_FORMAT : FH_ERROR_OK;
+}
+
+/* what fh_png_load() does with a decoded row */
+struct png_load
+{
+	unsigned char *buffer, *alpha;
+	int width;
+	fh_progress_fn progress;
+	void *ctx;
+};
+
+static int png_load_row(void *ctx, int y, unsigned char *row)
+{
+	struct png_load *l = (struct png_load*)ctx;
+
+	if (l->alpha)
+		fb_get_splitter()(l->buffer + (size_t)l->width * 3 * y, l->alpha + (size_t)l->width * y, row, l->width);
+	if (l->progress)
+		l->progress(l->ctx, y, y + 1);
+	return 0;
+}
+
+/*
+ * Interlaced files are read pass by pass over the whole image; with
+ * progress set the early passes fill in the pixels they skip ("rectangle"
+ * mode), so every pass is a complete coarser picture.
+ */
+static int fh_png_load(FILE *fh, unsigned char *buffer, unsigned char ** alpha,int x,int y,
+	fh_progress_fn progress, void *ctx)
+{
+	png_structp png_ptr;
+	png_infop info_ptr;
+	png_uint_32 width = x, height = y;
 	png_uint_32 i;
-	int bit_depth, color_type, interlace_type;
-	int number_passes,pass, trans = 0;
-	png_bytep rptr[2];
+	int number_passes,pass,ret;
 	unsigned char *rp;
 	unsigned char *fbptr;
-	FILE *fh;
-
-	if(!(fh = fopen(name,"rb"))) return(FH_ERROR_FILE);
+	struct png_load l;
+	struct png_rows r;
 
+	rewind(fh);
 	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,NULL,NULL,NULL);
 	if (png_ptr == NULL) return(FH_ERROR_FORMAT);
 	info_ptr = png_create_info_struct(png_ptr);
 	if (info_ptr == NULL)
 	{
 		png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
-		fclose(fh);
 		return(FH_ERROR_FORMAT);
 	}
 	rp = 0;
@@ -57,51 +221,77 @@ int fh_png_load(char *name, unsigned char *buffer, unsigned char ** alpha,int x,
 	{
 		png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
 		if(rp) free(rp);
-		fclose(fh);
 		return(FH_ERROR_FORMAT);
 	}
 
 	png_init_io(png_ptr,fh);
 
-	png_read_info(png_ptr, info_ptr);
-	png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, &interlace_type, NULL, NULL);
-	if (color_type == PNG_COLOR_TYPE_PALETTE) png_set_expand(png_ptr);
-	if (bit_depth < 8) png_set_packing(png_ptr);
-	if (color_type == PNG_COLOR_TYPE_GRAY || color_type== PNG_COLOR_TYPE_GRAY_ALPHA) png_set_gray_to_rgb(png_ptr);
-	if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+	memset(&l, 0, sizeof(l));
+	if (png_setup(png_ptr, info_ptr, &number_passes) &&
+	    !(l.alpha = *alpha = (unsigned char*) malloc((size_t)width * height)))
 	{
-		trans = 1;
-		png_set_tRNS_to_alpha(png_ptr);
+		png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+		return(FH_ERROR_FILE);
 	}
 
-	if(bit_depth == 16) png_set_strip_16(png_ptr);
-	number_passes = png_set_interlace_handling(png_ptr);
-	png_read_update_info(png_ptr, info_ptr);
-
-	if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA || color_type == PNG_COLOR_TYPE_RGB_ALPHA || trans)
+	if (number_passes == 1)
 	{
-		unsigned char * alpha_buffer = (unsigned char*) malloc(width * height);
-		unsigned char * aptr;
+		l.buffer = buffer;
+		l.width = width;
+		l.progress = progress;
+		l.ctx = ctx;
 
-		rp = (unsigned char*)malloc(width * 4);
-		rptr[0] = (png_bytep) rp;
+		memset(&r, 0, sizeof(r));
+		r.png_ptr = png_ptr;
+		r.info_ptr = info_ptr;
+		r.height = height;
+		r.use = l.alpha || progress ? png_load_row : NULL;
+		r.ctx = &l;
+		if (l.alpha)
+		{
+			r.ring = min(height, PNG_RING);
+			r.stride = (size_t)width * 4;
+			if (!(rp = (unsigned char*)malloc(r.stride * r.ring)))
+			{
+				png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+				return(FH_ERROR_FILE);
+			}
+		}
+		else
+		{
+			/* straight into the buffer */
+			r.ring = height;
+			r.stride = (size_t)width * 3;
+		}
+		r.rows = l.alpha ? rp : buffer;
+		ret = png_read_rows(&r, width);
+		png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+		free(rp);
+		return ret;
+	}
 
-		*alpha = alpha_buffer;
+	if (l.alpha)
+	{
+		/* later passes add to the rows of earlier ones: keep them all */
+		if (!(rp = (unsigned char*)malloc((size_t)width * 4 * height)))
+		{
+			png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+			return(FH_ERROR_FILE);
+		}
 
 		for (pass = 0; pass < number_passes; pass++)
 		{
-			fbptr = buffer;
-			aptr = alpha_buffer;
 			for(i=0; i<height; i++)
 			{
-				png_uint_32 n;
-				unsigned char *trp = rp;
-		   		png_read_rows(png_ptr, rptr, NULL, 1);
-				for(n = 0; n < width; n++, fbptr += 3, trp += 4)
-				{
-					memcpy(fbptr, trp, 3);
-					*(aptr++) = trp[3];
-				}
+				unsigned char *trp = rp + (size_t)width * 4 * i;
+
+				png_read_row(png_ptr, progress ? NULL : trp, progress ? trp : NULL);
+			}
+			if(progress || pass == number_passes - 1)
+			{
+				fb_get_splitter()(buffer, l.alpha, rp, (unsigned long)width * height);
+				if(progress)
+					progress(ctx, 0, height);
 			}
 		}
 		free(rp);
@@ -112,56 +302,98 @@ int fh_png_load(char *name, unsigned char *buffer, unsigned char ** alpha,int x,
 		{
 			fbptr = buffer;
 			for(i=0; i<height; i++, fbptr += width*3)
-			{
-				rptr[0] = (png_bytep) fbptr;
-		   		png_read_rows(png_ptr, rptr, NULL, 1);
-			}
+				png_read_row(png_ptr, progress ? NULL : fbptr, progress ? fbptr : NULL);
+			if(progress)
+				progress(ctx, 0, height);
 		}
 	}
 	png_read_end(png_ptr, info_ptr);
 	png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
-	fclose(fh);
 	return(FH_ERROR_OK);
 }
 
 
-int fh_png_getsize(char *name, int *x, int *y)
+/* what fh_png_load_rows() does with a decoded row */
+struct png_split_rows
+{
+	int width;
+	unsigned char *rgb, *alpha;
+	fh_row_fn row;
+	void *ctx;
+};
+
+static int png_split_row(void *ctx, int y, unsigned char *row)
+{
+	struct png_split_rows *s = (struct png_split_rows*)ctx;
+
+	if (!s->alpha)
+		return s->row(s->ctx, y, row, NULL);
+	fb_get_splitter()(s->rgb, s->alpha, row, s->width);
+	return s->row(s->ctx, y, s->rgb, s->alpha);
+}
+
+/* rows in order, so interlaced files cannot be read this way */
+static int fh_png_load_rows(FILE *fh, int x, int y, fh_row_fn row, void *ctx)
 {
 	png_structp png_ptr;
 	png_infop info_ptr;
-	png_uint_32 width, height;
-	int bit_depth, color_type, interlace_type;
-	char *rp;
-	FILE *fh;
+	int number_passes, ret = FH_ERROR_FORMAT;
+	unsigned char *rp, *rgb, *alpha;
+	struct png_split_rows s;
+	struct png_rows r;
 
-	if(!(fh=fopen(name,"rb"))) return(FH_ERROR_FILE);
-
-	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	rewind(fh);
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,NULL,NULL,NULL);
 	if (png_ptr == NULL) return(FH_ERROR_FORMAT);
 	info_ptr = png_create_info_struct(png_ptr);
-	if (info_ptr == NULL)
-	{
-		png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
-		fclose(fh);
-		return(FH_ERROR_FORMAT);
-	}
-	rp = 0;
+	rp = (unsigned char*)malloc((size_t)x * 4 * min(y, PNG_RING));
+	rgb = (unsigned char*)malloc(x * 3);
+	alpha = (unsigned char*)malloc(x);
+	if (info_ptr == NULL || !rp || !rgb || !alpha)
+		goto out;
 	if (setjmp(png_jmpbuf(png_ptr)))
-	{
-		png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
-		if(rp) free(rp);
-		fclose(fh);
-		return(FH_ERROR_FORMAT);
-	}
+		goto out;
 
 	png_init_io(png_ptr,fh);
-	png_read_info(png_ptr, info_ptr);
-	png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, &interlace_type, NULL, NULL);
+	s.width = x;
+	s.rgb = rgb;
+	s.alpha = png_setup(png_ptr, info_ptr, &number_passes) ? alpha : NULL;
+	s.row = row;
+	s.ctx = ctx;
+	if (number_passes > 1)
+		goto out;
+
+	memset(&r, 0, sizeof(r));
+	r.png_ptr = png_ptr;
+	r.info_ptr = info_ptr;
+	r.rows = rp;
+	r.stride = (size_t)x * (s.alpha ? 4 : 3);
+	r.ring = min(y, PNG_RING);
+	r.height = y;
+	r.use = png_split_row;
+	r.ctx = &s;
+	ret = png_read_rows(&r, x);
+out:
 	png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
-	*x = width;
-	*y = height;
-	fclose(fh);
+	free(rp);
+	free(rgb);
+	free(alpha);
+	return(ret);
+}
+
+
+/* the IHDR chunk always comes first, right after the signature */
+static int fh_png_getsize(FILE *fh, const unsigned char *hdr, int len, int *x, int *y, int wanted_x, int wanted_y)
+{
+	if(len < 24 || memcmp(hdr + 12, "IHDR", 4))
+		return(FH_ERROR_FORMAT);
+	*x = be32(hdr + 16);
+	*y = be32(hdr + 20);
+	if(*x <= 0 || *y <= 0)
+		return(FH_ERROR_FORMAT);
 	return(FH_ERROR_OK);
 }
+
+const struct fh_loader fh_png_loader = { "PNG", fh_png_id, fh_png_getsize, fh_png_load, fh_png_load_rows };
 #endif /*FBV_SUPPORT_PNG*/
 
@@ -0,0 +1,280 @@
+/*
+ * prefetch.c
+ *
+ * Decode and pre-transform the next images of the list on worker
+ * threads, and keep the ones just shown, so that moving through a
+ * slideshow in either direction does not wait for the decoder.
+ *
+ * A worker reserves what a picture is estimated to take before it
+ * starts decoding, and settles the account with what it really took
+ * once done, so decodes in flight count against the budget too.
+ */
+
+#include "config.h"
+#include "fbv.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct prefetch_entry
+{
+	struct picture pic;	/* first, so &pic is the entry */
+	int index;
+	int ready;
+	int users;
+	size_t bytes;
+	struct prefetch_entry *next;
+};
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	pthread_t *threads;
+	int nthreads;
+	char **files;
+	int count, ahead, current, quit;
+	size_t budget, used;	/* used: pictures held and reservations */
+	size_t *estimates;	/* per file, 0 until known */
+	struct prefetch_entry *entries;
+	prefetch_prepare_fn prepare;
+	prefetch_release_fn release;
+	prefetch_estimate_fn estimate;
+} pf = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static size_t picture_bytes(const struct picture *p)
+{
+	size_t n = (size_t)p->width * p->height * (p->alpha ? 4 : 3);
+
+	if(p->first.do_free)
+		n += (size_t)p->first.width * p->first.height * (p->first.alpha ? 4 : 3);
+	return n;
+}
+
+static struct prefetch_entry *find(int index)
+{
+	struct prefetch_entry *e;
+
+	for(e = pf.entries; e; e = e->next)
+		if(e->index == index)
+			return e;
+	return NULL;
+}
+
+static struct prefetch_entry *add(int index)
+{
+	struct prefetch_entry *e = (struct prefetch_entry*)calloc(1, sizeof(*e));
+
+	e->index = index;
+	e->next = pf.entries;
+	pf.entries = e;
+	return e;
+}
+
+static void drop(struct prefetch_entry **pp)
+{
+	struct prefetch_entry *e = *pp;
+
+	*pp = e->next;
+	pf.used -= e->bytes;
+	pf.release(&e->pic);
+	free(e);
+}
+
+/*
+ * Forget pictures out of reach of the current one, then, while over
+ * the budget with room bytes more, the ones furthest behind it.
+ * Pictures ahead are never dropped: a worker just does not start
+ * another one that does not fit.
+ */
+static void evict(size_t room)
+{
+	struct prefetch_entry **pp, **far;
+
+	for(pp = &pf.entries; *pp; )
+		if((*pp)->ready && !(*pp)->users && abs((*pp)->index - pf.current) > pf.ahead)
+			drop(pp);
+		else
+			pp = &(*pp)->next;
+
+	while(pf.used + room > pf.budget)
+	{
+		far = NULL;
+		for(pp = &pf.entries; *pp; pp = &(*pp)->next)
+			if((*pp)->ready && !(*pp)->users && (*pp)->index < pf.current &&
+			   (!far || (*pp)->index < (*far)->index))
+				far = pp;
+		if(!far)
+			break;
+		drop(far);
+	}
+}
+
+/* the nearest picture ahead not yet taken */
+static int next_job(void)
+{
+	int d;
+
+	for(d = 1; d <= pf.ahead && pf.current + d < pf.count; d++)
+		if(!find(pf.current + d))
+			return pf.current + d;
+	return -1;
+}
+
+/* called and returns with the lock held */
+static void prepare(struct prefetch_entry *e)
+{
+	pthread_mutex_unlock(&pf.lock);
+	pf.prepare(pf.files[e->index], &e->pic);
+	pthread_mutex_lock(&pf.lock);
+
+	/* the reservation, if any, becomes what was really taken */
+	pf.used -= e->bytes;
+	e->bytes = picture_bytes(&e->pic);
+	pf.used += e->bytes;
+	e->ready = 1;
+	pthread_cond_broadcast(&pf.done);
+	pthread_cond_broadcast(&pf.work);
+}
+
+static void *worker(void *arg)
+{
+	struct prefetch_entry *e;
+	size_t bytes;
+	int index;
+
+	pthread_mutex_lock(&pf.lock);
+	while(!pf.quit)
+	{
+		if((index = next_job()) < 0)
+		{
+			pthread_cond_wait(&pf.work, &pf.lock);
+			continue;
+		}
+		if(!pf.estimates[index])
+		{
+			/* read the header unlocked, then look again */
+			pthread_mutex_unlock(&pf.lock);
+			bytes = pf.estimate(pf.files[index]);
+			pthread_mutex_lock(&pf.lock);
+			pf.estimates[index] = bytes ? bytes : 1;
+			continue;
+		}
+		evict(pf.estimates[index]);
+		if(pf.used + pf.estimates[index] > pf.budget)
+		{
+			pthread_cond_wait(&pf.work, &pf.lock);
+			continue;
+		}
+		e = add(index);
+		e->bytes = pf.estimates[index];
+		pf.used += e->bytes;
+		prepare(e);
+		evict(0);
+	}
+	pthread_mutex_unlock(&pf.lock);
+	return NULL;
+}
+
+int prefetch_start(char **files, int count, int ahead, size_t budget,
+	prefetch_prepare_fn prepare, prefetch_release_fn release, prefetch_estimate_fn estimate)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	if(ahead <= 0 || count < 2)
+		return 0;
+
+	pf.files = files;
+	pf.count = count;
+	pf.ahead = ahead;
+	pf.budget = budget;
+	pf.prepare = prepare;
+	pf.release = release;
+	pf.estimate = estimate;
+	pf.estimates = (size_t*)calloc(count, sizeof(size_t));
+
+	pf.nthreads = ahead < cpus ? ahead : (cpus > 1 ? cpus : 1);
+	pf.threads = (pthread_t*)calloc(pf.nthreads, sizeof(pthread_t));
+	for(i = 0; i < pf.nthreads; i++)
+		if(pthread_create(&pf.threads[i], NULL, worker, NULL))
+			break;
+	pf.nthreads = i;
+	if(!i)
+	{
+		free(pf.threads);
+		pf.threads = NULL;
+		free(pf.estimates);
+		pf.estimates = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The picture of files[index], waiting for a worker still busy with it
+ * or preparing it here if none has started. NULL if not prefetching.
+ */
+struct picture *prefetch_get(int index)
+{
+	struct prefetch_entry *e;
+
+	if(!pf.threads)
+		return NULL;
+
+	pthread_mutex_lock(&pf.lock);
+	pf.current = index;
+	evict(0);
+	pthread_cond_broadcast(&pf.work);
+
+	if(!(e = find(index)))
+	{
+		e = add(index);
+		e->users++;
+		prepare(e);
+	}
+	else
+	{
+		e->users++;
+		while(!e->ready)
+			pthread_cond_wait(&pf.done, &pf.lock);
+	}
+	pthread_mutex_unlock(&pf.lock);
+	return &e->pic;
+}
+
+void prefetch_put(struct picture *p)
+{
+	struct prefetch_entry *e = (struct prefetch_entry*)p;
+
+	pthread_mutex_lock(&pf.lock);
+	e->users--;
+	evict(0);
+	pthread_cond_broadcast(&pf.work);
+	pthread_mutex_unlock(&pf.lock);
+}
+
+void prefetch_stop(void)
+{
+	int i;
+
+	if(!pf.threads)
+		return;
+
+	pthread_mutex_lock(&pf.lock);
+	pf.quit = 1;
+	pthread_cond_broadcast(&pf.work);
+	pthread_mutex_unlock(&pf.lock);
+
+	for(i = 0; i < pf.nthreads; i++)
+		pthread_join(pf.threads[i], NULL);
+	free(pf.threads);
+	pf.threads = NULL;
+
+	while(pf.entries)
+		drop(&pf.entries);
+	free(pf.estimates);
+	pf.estimates = NULL;
+}
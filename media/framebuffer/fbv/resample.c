@@ -0,0 +1,813 @@
+/*
+ * resample.c
+ *
+ * Separable fixed-point image scaling, turning by multiples of 90 degrees
+ * folded in. A sampler gives any band of rows of the turned and scaled
+ * image straight from the decoded one: every output row is filtered
+ * vertically from the rows it covers into a scratch row, then
+ * horizontally. Filter taps are worked out once per sampler as 1.14
+ * fixed point weights that sum to exactly 1 << 14; nearest neighbour is
+ * a single tap. The vertical pass over unturned rows has SSE2/AVX2 and
+ * NEON versions; bands of output rows are split across a pool of
+ * threads started once.
+ */
+
+#include "fbv.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FBV_RESAMPLE_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#define FBV_RESAMPLE_NEON
+#include <arm_neon.h>
+#endif
+
+#define FIX_BITS	14
+#define FIX_HALF	(1 << (FIX_BITS - 1))
+
+#define MIN_BAND_ROWS	8	/* not worth a thread below this */
+#define MAX_THREADS	8
+
+/* the taps of one output pixel (column or row) */
+struct taps
+{
+	int first, count;
+	short *weight;
+};
+
+struct coeffs
+{
+	struct taps *taps;
+	short *weights;
+	int max_count;
+};
+
+static inline unsigned char clamp_fix(int v)
+{
+	v >>= FIX_BITS;
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static double triangle(double x)
+{
+	x = fabs(x);
+	return x < 1 ? 1 - x : 0;
+}
+
+static double sinc(double x)
+{
+	if(x == 0)
+		return 1;
+	x *= M_PI;
+	return sin(x) / x;
+}
+
+static double lanczos2(double x)
+{
+	return (x > -2 && x < 2) ? sinc(x) * sinc(x / 2) : 0;
+}
+
+/*
+ * Taps for scaling in pixels to out. Nearest neighbour (filter 0) picks
+ * the pixel simple_resize() would. Area shrinking weighs every source
+ * pixel by how much of it the output pixel covers; the other filters are
+ * stretched by the shrink factor so they still average when shrinking.
+ */
+static int make_coeffs(struct coeffs *c, int in, int out, int filter)
+{
+	double scale = (double)in / out, fscale = scale > 1 ? scale : 1;
+	double support, *w;
+	int x, i, n, stride;
+	int area = filter == RESAMPLE_SMOOTH && out < in;
+	double (*f)(double) = filter == RESAMPLE_LANCZOS ? lanczos2 : triangle;
+
+	support = area ? scale / 2 : (filter == RESAMPLE_LANCZOS ? 2 : 1) * fscale;
+	stride = filter ? (int)ceil(support) * 2 + 2 : 1;
+
+	w = (double*)malloc(stride * sizeof(*w));
+	c->taps = (struct taps*)malloc(out * sizeof(*c->taps));
+	c->weights = (short*)malloc((size_t)out * stride * sizeof(short));
+	c->max_count = 0;
+	if(!w || !c->taps || !c->weights)
+	{
+		free(w);
+		free(c->taps);
+		free(c->weights);
+		return -1;
+	}
+
+	if(!filter)
+	{
+		for(x = 0; x < out; x++)
+		{
+			c->taps[x].first = (long)x * in / out;
+			c->taps[x].count = 1;
+			c->taps[x].weight = c->weights + x;
+			c->taps[x].weight[0] = 1 << FIX_BITS;
+		}
+		c->max_count = 1;
+		free(w);
+		return 0;
+	}
+
+	for(x = 0; x < out; x++)
+	{
+		struct taps *t = &c->taps[x];
+		double center = (x + 0.5) * scale, sum = 0;
+		int first, last, total = 0, big = 0;
+
+		first = (int)floor(center - support);
+		last = (int)ceil(center + support);
+		if(first < 0)
+			first = 0;
+		if(last > in)
+			last = in;
+
+		for(i = first; i < last; i++)
+		{
+			double v;
+
+			if(area)
+			{
+				double lo = center - support, hi = center + support;
+				v = (i + 1 < hi ? i + 1 : hi) - (i > lo ? i : lo);
+				if(v < 0)
+					v = 0;
+			}
+			else
+				v = f((i + 0.5 - center) / fscale);
+			w[i - first] = v;
+			sum += v;
+		}
+
+		/* drop taps with no weight at either end */
+		while(first < last - 1 && w[0] == 0)
+		{
+			memmove(w, w + 1, (last - first - 1) * sizeof(w[0]));
+			first++;
+		}
+		while(last - 1 > first && w[last - first - 1] == 0)
+			last--;
+
+		n = last - first;
+		t->first = first;
+		t->count = n;
+		t->weight = c->weights + (size_t)x * stride;
+		for(i = 0; i < n; i++)
+		{
+			t->weight[i] = (short)lrint(w[i] / sum * (1 << FIX_BITS));
+			total += t->weight[i];
+			if(t->weight[i] > t->weight[big])
+				big = i;
+		}
+		/* rounding must not brighten or darken flat areas */
+		t->weight[big] += (1 << FIX_BITS) - total;
+		if(n > c->max_count)
+			c->max_count = n;
+	}
+	free(w);
+	return 0;
+}
+
+static void free_coeffs(struct coeffs *c)
+{
+	free(c->taps);
+	free(c->weights);
+}
+
+/* bytes from..count of a row, left over by the vector versions */
+static void rows_tail(unsigned char *dst, const unsigned char * const *rows, const short *weight, int taps, unsigned long from, unsigned long count)
+{
+	unsigned long i;
+	int k;
+
+	for(i = from; i < count; i++)
+	{
+		int v = FIX_HALF;
+		for(k = 0; k < taps; k++)
+			v += weight[k] * rows[k][i];
+		dst[i] = clamp_fix(v);
+	}
+}
+
+static void rows_c(unsigned char *dst, const unsigned char * const *rows, const short *weight, int taps, unsigned long count)
+{
+	rows_tail(dst, rows, weight, taps, 0, count);
+}
+
+static int cpu_any(void)
+{
+	return 1;
+}
+
+#ifdef FBV_RESAMPLE_X86
+
+static int cpu_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+static int cpu_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+/* two taps' weights side by side in each 32 bit lane, for pmaddwd */
+static inline int weight_pair(const short *weight, int k, int taps)
+{
+	return (unsigned short)weight[k] | (k + 1 < taps ? (unsigned int)(unsigned short)weight[k + 1] << 16 : 0);
+}
+
+/* rows come in pairs: interleave them bytewise, widen, multiply-add */
+__attribute__((target("sse2")))
+static void rows_sse2(unsigned char *dst, const unsigned char * const *rows, const short *weight, int taps, unsigned long count)
+{
+	const __m128i zero = _mm_setzero_si128(), half = _mm_set1_epi32(FIX_HALF);
+	unsigned long i;
+	int k;
+
+	for(i = 0; i + 16 <= count; i += 16)
+	{
+		__m128i a0 = half, a1 = half, a2 = half, a3 = half;
+
+		for(k = 0; k < taps; k += 2)
+		{
+			__m128i w = _mm_set1_epi32(weight_pair(weight, k, taps));
+			__m128i p = _mm_loadu_si128((const __m128i *)(rows[k] + i));
+			__m128i q = k + 1 < taps ? _mm_loadu_si128((const __m128i *)(rows[k + 1] + i)) : zero;
+			__m128i lo = _mm_unpacklo_epi8(p, q), hi = _mm_unpackhi_epi8(p, q);
+
+			a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+			a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+			a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+			a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+		}
+		a0 = _mm_packs_epi32(_mm_srai_epi32(a0, FIX_BITS), _mm_srai_epi32(a1, FIX_BITS));
+		a2 = _mm_packs_epi32(_mm_srai_epi32(a2, FIX_BITS), _mm_srai_epi32(a3, FIX_BITS));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a0, a2));
+	}
+	rows_tail(dst, rows, weight, taps, i, count);
+}
+
+/* the same per 128 bit lane; the packs undo the lane split */
+__attribute__((target("avx2")))
+static void rows_avx2(unsigned char *dst, const unsigned char * const *rows, const short *weight, int taps, unsigned long count)
+{
+	const __m256i zero = _mm256_setzero_si256(), half = _mm256_set1_epi32(FIX_HALF);
+	unsigned long i;
+	int k;
+
+	for(i = 0; i + 32 <= count; i += 32)
+	{
+		__m256i a0 = half, a1 = half, a2 = half, a3 = half;
+
+		for(k = 0; k < taps; k += 2)
+		{
+			__m256i w = _mm256_set1_epi32(weight_pair(weight, k, taps));
+			__m256i p = _mm256_loadu_si256((const __m256i *)(rows[k] + i));
+			__m256i q = k + 1 < taps ? _mm256_loadu_si256((const __m256i *)(rows[k + 1] + i)) : zero;
+			__m256i lo = _mm256_unpacklo_epi8(p, q), hi = _mm256_unpackhi_epi8(p, q);
+
+			a0 = _mm256_add_epi32(a0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), w));
+			a1 = _mm256_add_epi32(a1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), w));
+			a2 = _mm256_add_epi32(a2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), w));
+			a3 = _mm256_add_epi32(a3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), w));
+		}
+		a0 = _mm256_packs_epi32(_mm256_srai_epi32(a0, FIX_BITS), _mm256_srai_epi32(a1, FIX_BITS));
+		a2 = _mm256_packs_epi32(_mm256_srai_epi32(a2, FIX_BITS), _mm256_srai_epi32(a3, FIX_BITS));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(a0, a2));
+	}
+	rows_tail(dst, rows, weight, taps, i, count);
+}
+
+#endif /* FBV_RESAMPLE_X86 */
+
+#ifdef FBV_RESAMPLE_NEON
+
+static void rows_neon(unsigned char *dst, const unsigned char * const *rows, const short *weight, int taps, unsigned long count)
+{
+	unsigned long i;
+	int k;
+
+	for(i = 0; i + 16 <= count; i += 16)
+	{
+		int32x4_t a0 = vdupq_n_s32(FIX_HALF), a1 = a0, a2 = a0, a3 = a0;
+
+		for(k = 0; k < taps; k++)
+		{
+			uint8x16_t p = vld1q_u8(rows[k] + i);
+			int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(p)));
+			int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(p)));
+
+			a0 = vmlal_n_s16(a0, vget_low_s16(lo), weight[k]);
+			a1 = vmlal_n_s16(a1, vget_high_s16(lo), weight[k]);
+			a2 = vmlal_n_s16(a2, vget_low_s16(hi), weight[k]);
+			a3 = vmlal_n_s16(a3, vget_high_s16(hi), weight[k]);
+		}
+		vst1q_u8(dst + i, vcombine_u8(
+			vqmovun_s16(vcombine_s16(vqshrn_n_s32(a0, FIX_BITS), vqshrn_n_s32(a1, FIX_BITS))),
+			vqmovun_s16(vcombine_s16(vqshrn_n_s32(a2, FIX_BITS), vqshrn_n_s32(a3, FIX_BITS)))));
+	}
+	rows_tail(dst, rows, weight, taps, i, count);
+}
+
+#endif /* FBV_RESAMPLE_NEON */
+
+/* best first */
+const struct resample_kernel resample_kernels[] =
+{
+#ifdef FBV_RESAMPLE_X86
+	{ "avx2", rows_avx2, cpu_avx2 },
+	{ "sse2", rows_sse2, cpu_sse2 },
+#endif
+#ifdef FBV_RESAMPLE_NEON
+	{ "neon", rows_neon, cpu_any },
+#endif
+	{ "c",    rows_c,    cpu_any },
+	{ NULL,   NULL,      NULL }
+};
+
+static resample_rows_fn get_rows_kernel(void)
+{
+	static resample_rows_fn rows;
+	const struct resample_kernel *k;
+
+	for(k = resample_kernels; !rows && k->name; k++)
+		if(k->supported())
+			rows = k->rows;
+	return rows;
+}
+
+#define IS_COPY(t)	((t)->count == 1 && (t)->weight[0] == 1 << FIX_BITS)
+
+/* scaled columns x0..x0+len-1 from a turned row starting at column c0 */
+static void filter_row(unsigned char *dst, const unsigned char *src, const struct coeffs *h, int x0, int len, int c0, int channels)
+{
+	int x, k, c;
+
+	for(x = x0; x < x0 + len; x++)
+	{
+		const struct taps *t = &h->taps[x];
+		const unsigned char *s = src + (t->first - c0) * channels;
+
+		if(IS_COPY(t))
+		{
+			for(c = 0; c < channels; c++)
+				*dst++ = s[c];
+		}
+		else if(channels == 3)
+		{
+			int r = FIX_HALF, g = FIX_HALF, b = FIX_HALF;
+			for(k = 0; k < t->count; k++, s += 3)
+			{
+				r += t->weight[k] * s[0];
+				g += t->weight[k] * s[1];
+				b += t->weight[k] * s[2];
+			}
+			*dst++ = clamp_fix(r);
+			*dst++ = clamp_fix(g);
+			*dst++ = clamp_fix(b);
+		}
+		else
+			for(c = 0; c < channels; c++)
+			{
+				int v = FIX_HALF;
+				for(k = 0; k < t->count; k++)
+					v += t->weight[k] * s[k * channels + c];
+				*dst++ = clamp_fix(v);
+			}
+	}
+}
+
+/*
+ * The source is turned by rotation (as rotate() does) before scaling:
+ * h holds the taps along a turned row, v along a turned column.
+ */
+struct sampler
+{
+	struct coeffs h, v;
+	int ox, oy, rotation;
+	resample_rows_fn rows;
+};
+
+struct sampler *sampler_new(int ox, int oy, int rotation, int dx, int dy, int filter)
+{
+	struct sampler *s;
+	int tw = rotation & 1 ? oy : ox, th = rotation & 1 ? ox : oy;
+
+	if(ox <= 0 || oy <= 0 || dx <= 0 || dy <= 0)
+		return NULL;
+	if(!(s = (struct sampler*)malloc(sizeof(*s))))
+		return NULL;
+	if(make_coeffs(&s->h, tw, dx, filter))
+	{
+		free(s);
+		return NULL;
+	}
+	if(make_coeffs(&s->v, th, dy, filter))
+	{
+		free_coeffs(&s->h);
+		free(s);
+		return NULL;
+	}
+	s->ox = ox;
+	s->oy = oy;
+	s->rotation = rotation & 3;
+	s->rows = get_rows_kernel();
+	return s;
+}
+
+void sampler_free(struct sampler *s)
+{
+	if(!s)
+		return;
+	free_coeffs(&s->h);
+	free_coeffs(&s->v);
+	free(s);
+}
+
+struct band
+{
+	const struct sampler *s;
+	const unsigned char *src;	/* source pixel sx, sy; rows width pixels apart */
+	int sx, sy, width;
+	int channels;
+	int y0, y1, x0, len;
+	unsigned char *dst;
+	size_t stride;
+	int failed;
+};
+
+/*
+ * Turned columns c0..c1-1 of the turned row filtered from the taps t,
+ * into scratch; returns where the result is. Unturned and upside down
+ * sources filter whole source rows at a time.
+ */
+static const unsigned char *filter_column(const struct band *b, const struct taps *t, int c0, int c1,
+	unsigned char *scratch, unsigned char *tmp, const unsigned char **rowp)
+{
+	const struct sampler *s = b->s;
+	int channels = b->channels;
+	size_t stride = (size_t)b->width * channels;
+	const unsigned char *src = b->src - ((size_t)b->sy * b->width + b->sx) * channels;
+	unsigned long n = (unsigned long)(c1 - c0) * channels;
+	const unsigned char *out;
+	int k, c, x;
+
+	if(s->rotation == 0)
+	{
+		for(k = 0; k < t->count; k++)
+			rowp[k] = src + (t->first + k) * stride + c0 * channels;
+		if(IS_COPY(t))
+			return rowp[0];
+		s->rows(scratch, rowp, t->weight, t->count, n);
+		return scratch;
+	}
+
+	/* 2: rows from the bottom, each read backwards */
+	for(k = 0; k < t->count; k++)
+		rowp[k] = src + (s->oy - 1 - t->first - k) * stride + (s->ox - c1) * channels;
+	if(IS_COPY(t))
+		out = rowp[0];
+	else
+	{
+		s->rows(tmp, rowp, t->weight, t->count, n);
+		out = tmp;
+	}
+	for(x = 0; x < c1 - c0; x++)
+		for(c = 0; c < channels; c++)
+			scratch[x * channels + c] = out[(c1 - c0 - 1 - x) * channels + c];
+	return scratch;
+}
+
+/* turned rows transposed at a time, unless one output row needs more */
+#define TURN_ROWS	64
+
+/*
+ * Turned by 90 degrees a turned row is a source column. Reading it a
+ * pixel per source row misses the cache on every pixel, so the source
+ * block under a run of turned rows (and columns c0..c1-1) is turned
+ * into blk with rotate_tiled() first, and its rows filtered as
+ * unturned ones. Returns -1 when out of memory.
+ */
+static int do_band_turned(struct band *b, int c0, int c1, unsigned char *scratch, const unsigned char **rowp)
+{
+	const struct sampler *s = b->s;
+	int channels = b->channels, y, ye, r0, r1, lo, hi, k, sx, sy;
+	size_t bstride = (size_t)(c1 - c0) * channels, size = 0;
+	unsigned long n = (unsigned long)(c1 - c0) * channels;
+	unsigned char *blk = NULL, *p;
+	const unsigned char *row;
+	const struct taps *t;
+
+	for(y = b->y0; y < b->y1; y = ye)
+	{
+		/* the turned rows r0..r1-1 of output rows y..ye-1 */
+		r0 = s->v.taps[y].first;
+		r1 = r0 + s->v.taps[y].count;
+		for(ye = y + 1; ye < b->y1; ye++)
+		{
+			t = &s->v.taps[ye];
+			lo = t->first < r0 ? t->first : r0;
+			hi = t->first + t->count > r1 ? t->first + t->count : r1;
+			if(hi - lo > TURN_ROWS)
+				break;
+			r0 = lo;
+			r1 = hi;
+		}
+
+		if((size_t)(r1 - r0) * bstride > size)
+		{
+			size = (size_t)(r1 - r0) * bstride;
+			if(!(p = (unsigned char*)realloc(blk, size)))
+			{
+				free(blk);
+				return -1;
+			}
+			blk = p;
+		}
+
+		/* rotation 1: turned (x, y) is source (y, oy-1-x); 3: (ox-1-y, x) */
+		sx = s->rotation == 1 ? r0 : s->ox - r1;
+		sy = s->rotation == 1 ? s->oy - c1 : c0;
+		rotate_tiled(blk, b->src + ((size_t)(sy - b->sy) * b->width + sx - b->sx) * channels, (size_t)b->width * channels,
+			r1 - r0, c1 - c0, s->rotation, channels);
+
+		for(; y < ye; y++)
+		{
+			t = &s->v.taps[y];
+			for(k = 0; k < t->count; k++)
+				rowp[k] = blk + (t->first - r0 + k) * bstride;
+			if(IS_COPY(t))
+				row = rowp[0];
+			else
+			{
+				s->rows(scratch, rowp, t->weight, t->count, n);
+				row = scratch;
+			}
+			filter_row(b->dst + (y - b->y0) * b->stride, row, &s->h, b->x0, b->len, c0, channels);
+		}
+	}
+	free(blk);
+	return 0;
+}
+
+static void do_band(struct band *b)
+{
+	const struct sampler *s = b->s;
+	const unsigned char *row;
+	unsigned char *scratch, *tmp;
+	const unsigned char **rowp;
+	int x, y, c0, c1;
+
+	/* the turned columns the wanted scaled ones need */
+	c0 = s->h.taps[b->x0].first;
+	c1 = c0;
+	for(x = b->x0; x < b->x0 + b->len; x++)
+		if(s->h.taps[x].first + s->h.taps[x].count > c1)
+			c1 = s->h.taps[x].first + s->h.taps[x].count;
+
+	scratch = (unsigned char*)malloc((size_t)(c1 - c0) * b->channels);
+	tmp = (unsigned char*)malloc((size_t)(c1 - c0) * b->channels);
+	rowp = (const unsigned char**)malloc(s->v.max_count * sizeof(*rowp));
+	if(!scratch || !tmp || !rowp)
+		b->failed = 1;
+	else if(s->rotation & 1)
+		b->failed = do_band_turned(b, c0, c1, scratch, rowp) ? 1 : 0;
+	else
+		for(y = b->y0; y < b->y1; y++)
+		{
+			row = filter_column(b, &s->v.taps[y], c0, c1, scratch, tmp, rowp);
+			filter_row(b->dst + (y - b->y0) * b->stride, row, &s->h, b->x0, b->len, c0, b->channels);
+		}
+	free(scratch);
+	free(tmp);
+	free(rowp);
+}
+
+/*
+ * The threads bands run on besides the caller's, started on first use
+ * and kept for good. One set of bands is in hand at a time; a caller
+ * that finds the pool busy (sampling from another thread) runs its
+ * bands itself.
+ */
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	pthread_once_t once;
+	int nthreads;
+	struct band *bands;	/* in hand, or NULL */
+	int count, next, pending;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_ONCE_INIT };
+
+static void *pool_worker(void *arg)
+{
+	struct band *b;
+
+	pthread_mutex_lock(&pool.lock);
+	while(1)
+	{
+		if(!pool.bands || pool.next >= pool.count)
+		{
+			pthread_cond_wait(&pool.work, &pool.lock);
+			continue;
+		}
+		b = &pool.bands[pool.next++];
+		pthread_mutex_unlock(&pool.lock);
+		do_band(b);
+		pthread_mutex_lock(&pool.lock);
+		if(!--pool.pending)
+			pthread_cond_broadcast(&pool.done);
+	}
+	return NULL;
+}
+
+static void pool_start(void)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while(pool.nthreads < ncpu - 1 && pool.nthreads < MAX_THREADS - 1 &&
+	      !pthread_create(&thread, &attr, pool_worker, NULL))
+		pool.nthreads++;
+	pthread_attr_destroy(&attr);
+}
+
+/* bands on the pool and this thread, or all here if the pool is busy */
+static void run_bands(struct band *band, int n)
+{
+	int i;
+
+	pthread_once(&pool.once, pool_start);
+	pthread_mutex_lock(&pool.lock);
+	if(n < 2 || !pool.nthreads || pool.bands)
+	{
+		pthread_mutex_unlock(&pool.lock);
+		for(i = 0; i < n; i++)
+			do_band(&band[i]);
+		return;
+	}
+	pool.bands = band;
+	pool.count = n;
+	pool.next = 0;
+	pool.pending = n;
+	pthread_cond_broadcast(&pool.work);
+	while(pool.next < pool.count)
+	{
+		i = pool.next++;
+		pthread_mutex_unlock(&pool.lock);
+		do_band(&band[i]);
+		pthread_mutex_lock(&pool.lock);
+		pool.pending--;
+	}
+	while(pool.pending)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pool.bands = NULL;
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+ * The source rectangle *sx, *sy, *width x *height that rows y0..y1-1,
+ * columns x0..x0+len-1 of the turned and scaled image are sampled from.
+ */
+void sampler_source(const struct sampler *s, int y0, int y1, int x0, int len,
+	int *sx, int *sy, int *width, int *height)
+{
+	int r0 = s->v.taps[y0].first, r1 = r0, c0 = s->h.taps[x0].first, c1 = c0, i;
+
+	for(i = y0; i < y1; i++)
+		if(s->v.taps[i].first + s->v.taps[i].count > r1)
+			r1 = s->v.taps[i].first + s->v.taps[i].count;
+	for(i = x0; i < x0 + len; i++)
+		if(s->h.taps[i].first + s->h.taps[i].count > c1)
+			c1 = s->h.taps[i].first + s->h.taps[i].count;
+
+	/* turned rows r0..r1-1 and columns c0..c1-1, turned back */
+	switch(s->rotation)
+	{
+	case 0:
+		*sx = c0; *sy = r0; *width = c1 - c0; *height = r1 - r0;
+		break;
+	case 1:
+		*sx = r0; *sy = s->oy - c1; *width = r1 - r0; *height = c1 - c0;
+		break;
+	case 2:
+		*sx = s->ox - c1; *sy = s->oy - r1; *width = c1 - c0; *height = r1 - r0;
+		break;
+	default:
+		*sx = s->ox - r1; *sy = c0; *width = r1 - r0; *height = c1 - c0;
+		break;
+	}
+}
+
+/*
+ * Rows y0..y1-1, columns x0..x0+len-1 of the turned and scaled image,
+ * sampled from src (1 or 3 channels) into dst, rows stride bytes apart.
+ * Bands of rows run on the pool. Returns -1 when out of memory.
+ */
+int sampler_rows(const struct sampler *s, const unsigned char *src, int channels,
+	int y0, int y1, int x0, int len, unsigned char *dst, size_t stride)
+{
+	return sampler_rows_from(s, src, 0, 0, s->ox, channels, y0, y1, x0, len, dst, stride);
+}
+
+/*
+ * As sampler_rows(), from only the part of the source at sx, sy in src,
+ * rows width pixels apart; it must hold what sampler_source() says.
+ */
+int sampler_rows_from(const struct sampler *s, const unsigned char *src, int sx, int sy, int width,
+	int channels, int y0, int y1, int x0, int len, unsigned char *dst, size_t stride)
+{
+	struct band band[MAX_THREADS];
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int n, i, failed = 0;
+
+	if(y1 <= y0 || len <= 0)
+		return 0;
+
+	n = (y1 - y0) / MIN_BAND_ROWS;
+	if(n > ncpu)
+		n = ncpu;
+	if(n > MAX_THREADS)
+		n = MAX_THREADS;
+	if(n < 1)
+		n = 1;
+
+	for(i = 0; i < n; i++)
+	{
+		band[i].s = s;
+		band[i].src = src;
+		band[i].sx = sx;
+		band[i].sy = sy;
+		band[i].width = width;
+		band[i].channels = channels;
+		band[i].y0 = y0 + (long)(y1 - y0) * i / n;
+		band[i].y1 = y0 + (long)(y1 - y0) * (i + 1) / n;
+		band[i].x0 = x0;
+		band[i].len = len;
+		band[i].dst = dst + (band[i].y0 - y0) * stride;
+		band[i].stride = stride;
+		band[i].failed = 0;
+	}
+	run_bands(band, n);
+
+	for(i = 0; i < n; i++)
+		failed |= band[i].failed;
+	return failed ? -1 : 0;
+}
+
+/*
+ * Scale an ox x oy image of 1 or 3 channel pixels to dx x dy with the
+ * given RESAMPLE_* filter. Returns a malloced image, or NULL when out
+ * of memory.
+ */
+unsigned char *resample(const unsigned char *src, int ox, int oy, int dx, int dy, int channels, int filter)
+{
+	struct sampler *s = sampler_new(ox, oy, 0, dx, dy, filter);
+	unsigned char *dst = NULL;
+
+	if(s && (dst = (unsigned char*)malloc((size_t)dx * dy * channels)))
+		if(sampler_rows(s, src, channels, 0, dy, 0, dx, dst, (size_t)dx * channels))
+		{
+			free(dst);
+			dst = NULL;
+		}
+	sampler_free(s);
+	return dst;
+}
+
+/*
+ * An ox x oy image halved: every pixel the rounded average of a 2 x 2
+ * block, the last row and column dropped when ox or oy is odd. Returns
+ * a malloced ox / 2 x oy / 2 image, or NULL when out of memory.
+ */
+unsigned char *halve(const unsigned char *src, int ox, int oy, int channels)
+{
+	int dx = ox / 2, dy = oy / 2, x, y, c;
+	size_t stride = (size_t)ox * channels;
+	unsigned char *dst, *d;
+
+	if(!dx || !dy || !(dst = (unsigned char*)malloc((size_t)dx * dy * channels)))
+		return NULL;
+	for(y = 0, d = dst; y < dy; y++)
+	{
+		const unsigned char *a = src + 2 * y * stride, *b = a + stride;
+
+		for(x = 0; x < dx; x++, a += 2 * channels, b += 2 * channels)
+			for(c = 0; c < channels; c++)
+				*d++ = (a[c] + a[c + channels] + b[c] + b[c + channels] + 2) >> 2;
+	}
+	return dst;
+}
@@ -0,0 +1,179 @@
+/*
+ * convert_test - check every RGB888 converter, alpha blender and RGBA
+ * splitter usable on this CPU against the scalar one, byte for byte.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../fbv.h"
+
+#define MAX_PIXELS	300
+#define PAD		8
+
+static const struct fb_converter *reference(int bpp)
+{
+	const struct fb_converter *c;
+
+	for(c = fb_converters; c->name; c++)
+		if(c->bpp == bpp && !strcmp(c->name, "c"))
+			return c;
+	return NULL;
+}
+
+static int test_blenders(const unsigned char *src)
+{
+	static unsigned char dst[3 * MAX_PIXELS + PAD], alpha[MAX_PIXELS + PAD], want[3 * MAX_PIXELS + PAD], got[3 * MAX_PIXELS + PAD];
+	const struct fb_blender *b, *ref = NULL;
+	unsigned long n, i;
+	int offs, failed = 0;
+
+	for(b = fb_blenders; b->name; b++)
+		if(!strcmp(b->name, "c"))
+			ref = b;
+
+	/* mostly the end points, which must come out exact */
+	for(i = 0; i < sizeof(dst); i++)
+		dst[i] = rand();
+	for(i = 0; i < sizeof(alpha); i++)
+		alpha[i] = i % 3 ? rand() : (i & 8 ? 0xff : 0);
+
+	for(b = fb_blenders; b->name; b++)
+	{
+		if(!b->supported())
+		{
+			printf("%-6s blend: not supported here\n", b->name);
+			continue;
+		}
+		for(n = 0; n <= MAX_PIXELS; n += n < 70 ? 1 : 23)
+			for(offs = 0; offs < 4; offs++)
+			{
+				memcpy(want, dst, sizeof(want));
+				memcpy(got, dst, sizeof(got));
+				ref->blend(want + offs, src + offs, alpha + offs, n);
+				b->blend(got + offs, src + offs, alpha + offs, n);
+				if(memcmp(want, got, sizeof(got)))
+				{
+					printf("%-6s blend: mismatch, %lu pixels at offset %d\n", b->name, n, offs);
+					failed++;
+					goto next;
+				}
+			}
+		printf("%-6s blend: ok\n", b->name);
+next:		;
+	}
+
+	/* the reference itself: a = 0 keeps dst, a = 255 gives src */
+	memcpy(want, dst, sizeof(want));
+	memset(alpha, 0, MAX_PIXELS);
+	ref->blend(want, src, alpha, MAX_PIXELS);
+	if(memcmp(want, dst, 3 * MAX_PIXELS))
+		failed++;
+	memset(alpha, 0xff, MAX_PIXELS);
+	ref->blend(want, src, alpha, MAX_PIXELS);
+	if(memcmp(want, src, 3 * MAX_PIXELS))
+		failed++;
+
+	return failed;
+}
+
+static int test_splitters(void)
+{
+	static unsigned char rgba[4 * MAX_PIXELS + PAD];
+	static unsigned char want[3 * MAX_PIXELS + PAD], got[3 * MAX_PIXELS + PAD];
+	static unsigned char want_a[MAX_PIXELS + PAD], got_a[MAX_PIXELS + PAD];
+	const struct fb_splitter *s, *ref = NULL;
+	unsigned long n, i;
+	int offs, failed = 0;
+
+	for(s = fb_splitters; s->name; s++)
+		if(!strcmp(s->name, "c"))
+			ref = s;
+	for(i = 0; i < sizeof(rgba); i++)
+		rgba[i] = rand();
+
+	for(s = fb_splitters; s->name; s++)
+	{
+		if(!s->supported())
+		{
+			printf("%-6s split: not supported here\n", s->name);
+			continue;
+		}
+		for(n = 0; n <= MAX_PIXELS; n += n < 70 ? 1 : 23)
+			for(offs = 0; offs < 4; offs++)
+			{
+				memset(want, 0xa5, sizeof(want));
+				memset(got, 0xa5, sizeof(got));
+				memset(want_a, 0xa5, sizeof(want_a));
+				memset(got_a, 0xa5, sizeof(got_a));
+				ref->split(want + offs, want_a + offs, rgba + offs, n);
+				s->split(got + offs, got_a + offs, rgba + offs, n);
+				if(memcmp(want, got, sizeof(got)) || memcmp(want_a, got_a, sizeof(got_a)))
+				{
+					printf("%-6s split: mismatch, %lu pixels at offset %d\n", s->name, n, offs);
+					failed++;
+					goto next;
+				}
+			}
+		printf("%-6s split: ok\n", s->name);
+next:		;
+	}
+
+	/* the reference itself */
+	ref->split(want, want_a, rgba, MAX_PIXELS);
+	for(i = 0; i < MAX_PIXELS; i++)
+		if(memcmp(want + 3 * i, rgba + 4 * i, 3) || want_a[i] != rgba[4 * i + 3])
+		{
+			failed++;
+			break;
+		}
+
+	return failed;
+}
+
+int main(void)
+{
+	static unsigned char src[3 * MAX_PIXELS + PAD], want[4 * MAX_PIXELS + PAD], got[4 * MAX_PIXELS + PAD];
+	const struct fb_converter *c, *ref;
+	unsigned long n, i;
+	int offs, failed = 0, tested = 0;
+
+	srand(1);
+	for(i = 0; i < sizeof(src); i++)
+		src[i] = rand();
+
+	for(c = fb_converters; c->name; c++)
+	{
+		if(!c->supported())
+		{
+			printf("%-6s %2d bpp: not supported here\n", c->name, c->bpp);
+			continue;
+		}
+		ref = reference(c->bpp);
+		for(n = 0; n <= MAX_PIXELS; n += n < 70 ? 1 : 23)
+			for(offs = 0; offs < 4; offs++)
+			{
+				memset(want, 0xa5, sizeof(want));
+				memset(got, 0xa5, sizeof(got));
+				ref->convert(want + offs, src + offs, n);
+				c->convert(got + offs, src + offs, n);
+				/* also catches writes past the last pixel */
+				if(memcmp(want, got, sizeof(got)))
+				{
+					printf("%-6s %2d bpp: mismatch, %lu pixels at offset %d\n",
+					       c->name, c->bpp, n, offs);
+					failed++;
+					goto next;
+				}
+			}
+		printf("%-6s %2d bpp: ok\n", c->name, c->bpp);
+		tested++;
+next:		;
+	}
+
+	failed += test_blenders(src);
+	failed += test_splitters();
+
+	printf("%d converters ok, %d failed\n", tested, failed);
+	return failed ? 1 : 0;
+}
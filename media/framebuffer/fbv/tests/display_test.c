@@ -0,0 +1,226 @@
+/*
+ * display_test - the display library fbv and fbshow share: a BMP written
+ * here is identified, decoded and shown centered on framebuffers in
+ * memory of every depth, which must then hold exactly the picture run
+ * through its converter with black around it. Each viewer named on the
+ * command line is run on the same file and must leave the same frame.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../fbv.h"
+
+#define WIDTH	37
+#define HEIGHT	23
+#define XRES	64
+#define YRES	48
+
+static const struct
+{
+	int bpp, line, pages;
+} modes[] =
+{
+	{ 8, 0, 1 }, { 15, 0, 1 }, { 16, 0, 1 }, { 24, 0, 1 }, { 32, 0, 1 },
+	{ 16, 2 * XRES + 24, 1 }, { 24, 3 * XRES + 5, 1 }, { 32, 0, 2 },
+};
+
+static void put16(FILE *f, unsigned v)
+{
+	fputc(v, f);
+	fputc(v >> 8, f);
+}
+
+static void put32(FILE *f, unsigned v)
+{
+	put16(f, v);
+	put16(f, v >> 16);
+}
+
+/* 24 bit, bottom up, rows padded to 4 bytes */
+static int write_bmp(const char *path, const unsigned char *rgb, int width, int height)
+{
+	int stride = (width * 3 + 3) & ~3, x, y;
+	FILE *f;
+
+	if(!(f = fopen(path, "wb")))
+		return -1;
+	fputs("BM", f);
+	put32(f, 54 + stride * height);
+	put32(f, 0);
+	put32(f, 54);
+	put32(f, 40);
+	put32(f, width);
+	put32(f, height);
+	put16(f, 1);
+	put16(f, 24);
+	put32(f, 0);
+	put32(f, stride * height);
+	put32(f, 2835);
+	put32(f, 2835);
+	put32(f, 0);
+	put32(f, 0);
+	for(y = height - 1; y >= 0; y--)
+	{
+		for(x = 0; x < width; x++)
+		{
+			const unsigned char *p = rgb + (y * width + x) * 3;
+			fputc(p[2], f);
+			fputc(p[1], f);
+			fputc(p[0], f);
+		}
+		for(x = width * 3; x < stride; x++)
+			fputc(0, f);
+	}
+	return fclose(f);
+}
+
+static int mode_line(int i)
+{
+	return modes[i].line ? modes[i].line : XRES * ((modes[i].bpp + 7) / 8);
+}
+
+static void mode_name(char *buf, size_t len, int i, const char *file)
+{
+	int n = snprintf(buf, len, "mem:%dx%dx%d", XRES, YRES, modes[i].bpp);
+
+	if(modes[i].line)
+		n += snprintf(buf + n, len - n, ",line=%d", modes[i].line);
+	if(modes[i].pages > 1)
+		n += snprintf(buf + n, len - n, ",yres_virtual=%d", modes[i].pages * YRES);
+	if(file)
+		snprintf(buf + n, len - n, ",file=%s", file);
+}
+
+/* one page: the picture converted row by row, centered */
+static unsigned char *expected(int i, const unsigned char *rgb)
+{
+	const struct fb_converter *conv = fb_get_converter(modes[i].bpp);
+	int line = mode_line(i), x0 = (XRES - WIDTH) / 2, y0 = (YRES - HEIGHT) / 2, y;
+	unsigned char *page = (unsigned char*)calloc(line, YRES);
+
+	for(y = 0; y < HEIGHT; y++)
+		conv->convert(page + (y0 + y) * line + x0 * conv->cpp, rgb + y * WIDTH * 3, WIDTH);
+	return page;
+}
+
+static int decode(const char *path, unsigned char **rgb, int *width, int *height)
+{
+	const struct fh_loader *l;
+	unsigned char hdr[FH_HEADER_LEN], *alpha = NULL;
+	int len, ret = -1;
+	FILE *fh;
+
+	if(!(fh = fopen(path, "rb")))
+		return -1;
+	if((l = fh_identify(fh, hdr, &len, width, height)) &&
+	   (*rgb = (unsigned char*)malloc(*width * *height * 3)))
+	{
+		ret = l->load(fh, *rgb, &alpha, *width, *height, NULL, NULL) == FH_ERROR_OK ? 0 : -1;
+		if(ret)
+			free(*rgb);
+	}
+	free(alpha);
+	fclose(fh);
+	return ret;
+}
+
+static int test_library(int i, const char *bmp, const unsigned char *want)
+{
+	char name[128];
+	struct fb_context fb;
+	struct image img;
+	int width, height, failed = 0;
+
+	mode_name(name, sizeof(name), i, NULL);
+	memset(&img, 0, sizeof(img));
+	if(decode(bmp, &img.rgb, &width, &height) || width != WIDTH || height != HEIGHT)
+	{
+		printf("%-40s decode failed\n", name);
+		return 1;
+	}
+	img.width = width;
+	img.height = height;
+	if(fb_open(&fb, name))
+	{
+		free(img.rgb);
+		printf("%-40s open failed\n", name);
+		return 1;
+	}
+	fb_display(&fb, &img, 0, 0, (XRES - WIDTH) / 2, (YRES - HEIGHT) / 2);
+	if(memcmp(fb.mem + fb.var.yoffset * fb.fix.line_length, want, mode_line(i) * YRES))
+	{
+		printf("%-40s library: frame differs\n", name);
+		failed = 1;
+	}
+	fb_close(&fb);
+	fb_image_invalidate(&img);
+	free(img.rgb);
+	return failed;
+}
+
+/* the viewer draws into a file that holds the framebuffer */
+static int test_viewer(int i, const char *viewer, const char *bmp, const char *dump, const unsigned char *want)
+{
+	char name[256], cmd[1024];
+	int size = mode_line(i) * YRES, failed = 1;
+	unsigned char *got = (unsigned char*)malloc(size);
+	FILE *f = NULL;
+
+	unlink(dump);
+	mode_name(name, sizeof(name), i, dump);
+	snprintf(cmd, sizeof(cmd), "FRAMEBUFFER=%s %s %s </dev/null >/dev/null 2>&1", name, viewer, bmp);
+	if(system(cmd))
+		printf("%-40s %s: failed\n", name, viewer);
+	else if(!(f = fopen(dump, "rb")) || fread(got, 1, size, f) != (size_t)size)
+		printf("%-40s %s: no frame\n", name, viewer);
+	else if(memcmp(got, want, size))
+		printf("%-40s %s: frame differs\n", name, viewer);
+	else
+		failed = 0;
+	if(f)
+		fclose(f);
+	free(got);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	char bmp[] = "/tmp/display_testXXXXXX", dump[sizeof(bmp) + 4];
+	unsigned char rgb[WIDTH * HEIGHT * 3], *want;
+	unsigned int i, v;
+	int fd, failed = 0;
+
+	srand(1);
+	for(i = 0; i < sizeof(rgb); i++)
+		rgb[i] = rand();
+	if((fd = mkstemp(bmp)) == -1)
+	{
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	snprintf(dump, sizeof(dump), "%s.raw", bmp);
+	if(write_bmp(bmp, rgb, WIDTH, HEIGHT))
+	{
+		perror(bmp);
+		return 1;
+	}
+
+	for(i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+	{
+		want = expected(i, rgb);
+		failed += test_library(i, bmp, want);
+		/* where a viewer's last page ends up is not in the file */
+		if(modes[i].pages == 1)
+			for(v = 1; v < (unsigned int)argc; v++)
+				failed += test_viewer(i, argv[v], bmp, dump, want);
+		free(want);
+	}
+
+	unlink(bmp);
+	unlink(dump);
+	printf("display: %d failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * resample_test - check every vertical resample kernel usable on this
+ * CPU against the scalar one, resample() and halve() on images whose
+ * result is known, and the sampler fbv displays with against rotate()
+ * followed by resample().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../fbv.h"
+
+#define MAX_BYTES	300
+#define MAX_TAPS	9
+#define PAD		8
+
+static int test_kernels(void)
+{
+	static unsigned char rows[MAX_TAPS][MAX_BYTES + PAD], want[MAX_BYTES + PAD], got[MAX_BYTES + PAD];
+	const unsigned char *rowp[MAX_TAPS];
+	const struct resample_kernel *k, *ref = NULL;
+	short weight[MAX_TAPS];
+	unsigned long n;
+	int i, j, taps, failed = 0;
+
+	for(k = resample_kernels; k->name; k++)
+		if(!strcmp(k->name, "c"))
+			ref = k;
+	for(i = 0; i < MAX_TAPS; i++)
+		for(j = 0; j < MAX_BYTES + PAD; j++)
+			rows[i][j] = rand();
+
+	for(k = resample_kernels; k->name; k++)
+	{
+		if(!k->supported())
+		{
+			printf("%-5s rows: not supported here\n", k->name);
+			continue;
+		}
+		for(taps = 1; taps <= MAX_TAPS; taps++)
+		{
+			/* weights summing to 1 << 14, negative lobes included */
+			int sum = 0;
+			for(i = 0; i < taps; i++)
+			{
+				weight[i] = rand() % 6000 - 1000;
+				sum += weight[i];
+			}
+			weight[taps / 2] += (1 << 14) - sum;
+
+			for(n = 0; n <= MAX_BYTES; n += n < 70 ? 1 : 23)
+				for(i = 0; i < 3; i++)
+				{
+					for(j = 0; j < taps; j++)
+						rowp[j] = rows[(j + i) % MAX_TAPS] + i;
+					memset(want, 0xa5, sizeof(want));
+					memset(got, 0xa5, sizeof(got));
+					ref->rows(want, rowp, weight, taps, n);
+					k->rows(got, rowp, weight, taps, n);
+					if(memcmp(want, got, sizeof(got)))
+					{
+						printf("%-5s rows: mismatch, %d taps, %lu bytes\n", k->name, taps, n);
+						failed++;
+						goto next;
+					}
+				}
+		}
+		printf("%-5s rows: ok\n", k->name);
+next:		;
+	}
+	return failed;
+}
+
+/* a flat image stays flat whatever the filter and the sizes */
+static int test_flat(void)
+{
+	static const int sizes[][4] = {
+		{ 100, 80, 37, 29 }, { 37, 29, 100, 80 }, { 640, 10, 3, 1 },
+		{ 1, 1, 5, 7 }, { 64, 64, 64, 64 }, { 2400, 3, 7, 9 },
+	};
+	unsigned char *src, *dst;
+	unsigned s, j;
+	int filter, failed = 0;
+
+	for(filter = RESAMPLE_SMOOTH; filter <= RESAMPLE_LANCZOS; filter++)
+		for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+		{
+			const int *z = sizes[s];
+			size_t n = (size_t)z[0] * z[1] * 3;
+
+			src = (unsigned char*)malloc(n);
+			for(j = 0; j < n; j++)
+				src[j] = j % 3 == 0 ? 0 : j % 3 == 1 ? 137 : 255;
+			dst = resample(src, z[0], z[1], z[2], z[3], 3, filter);
+			for(j = 0; dst && j < (unsigned)z[2] * z[3] * 3; j++)
+				if(dst[j] != src[j % 3])
+					break;
+			if(!dst || j < (unsigned)z[2] * z[3] * 3)
+			{
+				printf("filter %d: %dx%d to %dx%d not flat\n", filter, z[0], z[1], z[2], z[3]);
+				failed++;
+			}
+			free(src);
+			free(dst);
+		}
+	return failed;
+}
+
+/* same size is a copy, halving averages 2x2 blocks */
+static int test_exact(void)
+{
+	enum { W = 50, H = 34 };
+	unsigned char src[W * H], *dst;
+	int x, y, failed = 0;
+
+	for(x = 0; x < W * H; x++)
+		src[x] = rand();
+
+	dst = resample(src, W, H, W, H, 1, RESAMPLE_SMOOTH);
+	if(!dst || memcmp(dst, src, sizeof(src)))
+	{
+		printf("same size: not a copy\n");
+		failed++;
+	}
+	free(dst);
+
+	dst = resample(src, W, H, W / 2, H / 2, 1, RESAMPLE_SMOOTH);
+	for(y = 0; dst && y < H / 2; y++)
+		for(x = 0; x < W / 2; x++)
+		{
+			int s = src[2*y*W + 2*x] + src[2*y*W + 2*x + 1] + src[(2*y+1)*W + 2*x] + src[(2*y+1)*W + 2*x + 1];
+			int d = dst[y * (W / 2) + x];
+			if(d < s / 4 - 1 || d > (s + 3) / 4 + 1)
+			{
+				printf("halving: %d at %d,%d, want about %d\n", d, x, y, s / 4);
+				failed++;
+				y = H;
+				break;
+			}
+		}
+	free(dst);
+
+	/* halve() rounds the 2x2 average and drops the odd row and column */
+	dst = halve(src, W - 1, H - 1, 1);
+	for(y = 0; dst && y < (H - 1) / 2; y++)
+		for(x = 0; x < (W - 1) / 2; x++)
+		{
+			int s = src[2*y*(W-1) + 2*x] + src[2*y*(W-1) + 2*x + 1] + src[(2*y+1)*(W-1) + 2*x] + src[(2*y+1)*(W-1) + 2*x + 1];
+			if(dst[y * ((W - 1) / 2) + x] != (s + 2) / 4)
+			{
+				printf("halve: %d at %d,%d, want %d\n", dst[y * ((W - 1) / 2) + x], x, y, (s + 2) / 4);
+				failed++;
+				y = H;
+				break;
+			}
+		}
+	if(!dst)
+		failed++;
+	free(dst);
+	return failed;
+}
+
+/* the turned and scaled image, whole and a window of it, at every turn */
+static int test_sampler(void)
+{
+	enum { W = 150, H = 97 };
+	static const int scale[][4] = {	/* dx, dy as num / den of the turned size */
+		{ 1, 1, 1, 1 }, { 1, 3, 1, 3 }, { 7, 3, 2, 1 }, { 1, 2, 3, 2 }, { 1, 150, 1, 1 },
+	};
+	unsigned char src[W * H * 3], part[W * H * 3], *turned, *want, *got;
+	int ch, r, f, i, y, tw, th, dx, dy, x0, len, y0, y1, k, sx, sy, sw, sh, failed = 0;
+	struct sampler *s;
+
+	for(i = 0; i < W * H * 3; i++)
+		src[i] = rand();
+
+	for(ch = 1; ch <= 3; ch += 2)
+		for(r = 0; r < 4; r++)
+		{
+			tw = r & 1 ? H : W;
+			th = r & 1 ? W : H;
+			if(!r)
+				turned = (unsigned char*)memcpy(malloc(sizeof(src)), src, sizeof(src));
+			else
+				turned = ch == 3 ? rotate(src, W, H, r) : alpha_rotate(src, W, H, r);
+			for(f = 0; f <= RESAMPLE_LANCZOS; f++)
+				for(i = 0; i < (int)(sizeof(scale) / sizeof(scale[0])); i++)
+				{
+					dx = tw * scale[i][0] / scale[i][1] ? tw * scale[i][0] / scale[i][1] : 1;
+					dy = th * scale[i][2] / scale[i][3];
+					want = resample(turned, tw, th, dx, dy, ch, f);
+					got = (unsigned char*)malloc((size_t)dx * dy * ch);
+					s = sampler_new(W, H, r, dx, dy, f);
+					if(!want || !got || !s)
+					{
+						printf("sampler: out of memory\n");
+						failed++;
+					}
+					else if(sampler_rows(s, src, ch, 0, dy, 0, dx, got, (size_t)dx * ch) ||
+						memcmp(got, want, (size_t)dx * dy * ch))
+					{
+						printf("sampler: %d channels, turn %d, filter %d, %dx%d: differs\n", ch, r, f, dx, dy);
+						failed++;
+					}
+					else
+						/* a window, as the display samples it: from the whole
+						 * source, then from only the part it needs, as tiles give */
+						for(k = 0; k < 2; k++)
+						{
+							x0 = dx / 3;
+							len = dx - x0 > 1 ? (dx - x0) / 2 + 1 : 1;
+							y0 = dy / 4;
+							y1 = dy - dy / 5;
+							sampler_source(s, y0, y1, x0, len, &sx, &sy, &sw, &sh);
+							for(y = 0; k && y < sh; y++)
+								memcpy(part + (size_t)y * sw * ch, src + ((size_t)(sy + y) * W + sx) * ch, (size_t)sw * ch);
+							if(k ? sampler_rows_from(s, part, sx, sy, sw, ch, y0, y1, x0, len, got, (size_t)len * ch) :
+							       sampler_rows(s, src, ch, y0, y1, x0, len, got, (size_t)len * ch))
+								y0 = y1 = -1;
+							for(y = y0; y < y1; y++)
+								if(memcmp(got + (size_t)(y - y0) * len * ch, want + ((size_t)y * dx + x0) * ch, (size_t)len * ch))
+									break;
+							if(y != y1 || y0 < 0)
+							{
+								printf("sampler: %d channels, turn %d, filter %d, %dx%d %s: differs\n",
+									ch, r, f, dx, dy, k ? "part" : "window");
+								failed++;
+							}
+						}
+					sampler_free(s);
+					free(want);
+					free(got);
+				}
+			free(turned);
+		}
+	return failed;
+}
+
+int main(void)
+{
+	int failed = 0;
+
+	srand(1);
+	failed += test_kernels();
+	failed += test_flat();
+	failed += test_exact();
+	failed += test_sampler();
+
+	printf("resample: %d failed\n", failed);
+	return failed ? 1 : 0;
+}
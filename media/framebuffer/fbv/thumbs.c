@@ -0,0 +1,377 @@
+/*
+ * thumbs.c
+ *
+ * Thumbnails for the grid: made on worker threads, the files asked for
+ * first, and kept in a cache directory ($XDG_CACHE_HOME/fbv, else
+ * ~/.cache/fbv) so that browsing the same files again decodes nothing.
+ * The cache is two files: thumbs.dat holds the pixels, one thumbnail
+ * after the other, and thumbs.idx, mapped, is a hash table from the
+ * absolute path of a file to where its thumbnail is, valid as long as
+ * the file keeps its mtime and size. When either fills up the cache
+ * starts over empty.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fbv.h"
+
+#define THUMB_BUCKETS	16384
+#define THUMB_DATA_MAX	(256 << 20)	/* bytes of thumbs.dat */
+#define THUMB_WORKERS	4
+
+struct thumb_index
+{
+	char magic[8];
+	u_int32_t size, buckets;
+	u_int64_t end;		/* bytes of thumbs.dat in use */
+	u_int32_t used;		/* buckets */
+	u_int32_t pad;
+};
+
+struct thumb_entry
+{
+	u_int64_t key;		/* hash of the path, 0 for an empty bucket */
+	int64_t mtime, bytes;	/* of the file */
+	u_int64_t offset;	/* of the pixels in thumbs.dat */
+	u_int16_t width, height;
+	u_int32_t pad;
+};
+
+static const char thumb_magic[8] = "fbvthm1";
+
+#define THUMB_INDEX_BYTES	(sizeof(struct thumb_index) + THUMB_BUCKETS * sizeof(struct thumb_entry))
+
+enum { THUMB_NONE, THUMB_BUSY, THUMB_DONE, THUMB_FAILED };
+
+struct thumb_slot
+{
+	int state;
+	struct thumb t;
+};
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_t threads[THUMB_WORKERS];
+	int nthreads, quit;
+	char **files;
+	int count, first, want;
+	struct thumb_slot *slots;
+	thumb_make_fn make;
+	int pipe[2];
+
+	/* the cache, if it could be opened */
+	pthread_mutex_t cache_lock;
+	int idx_fd, dat_fd;
+	struct thumb_index *index;
+	struct thumb_entry *entries;
+} th = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static u_int64_t thumb_key(const char *path)
+{
+	u_int64_t h = 14695981039346656037ULL;
+
+	while(*path)
+		h = (h ^ (unsigned char)*path++) * 1099511628211ULL;
+	return h ? h : 1;
+}
+
+static void cache_reset(void)
+{
+	memset(th.entries, 0, THUMB_BUCKETS * sizeof(*th.entries));
+	memcpy(th.index->magic, thumb_magic, sizeof(thumb_magic));
+	th.index->size = THUMB_SIZE;
+	th.index->buckets = THUMB_BUCKETS;
+	th.index->end = 0;
+	th.index->used = 0;
+	ftruncate(th.dat_fd, 0);
+}
+
+static int cache_open(void)
+{
+	const char *base = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+	char dir[PATH_MAX - 16], path[PATH_MAX];
+	void *map;
+
+	if(base && *base)
+	{
+		mkdir(base, 0700);
+		snprintf(dir, sizeof(dir), "%s/fbv", base);
+	}
+	else if(home && *home)
+	{
+		snprintf(dir, sizeof(dir), "%s/.cache", home);
+		mkdir(dir, 0700);
+		snprintf(dir, sizeof(dir), "%s/.cache/fbv", home);
+	}
+	else
+		return -1;
+	if(mkdir(dir, 0700) && errno != EEXIST)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/thumbs.idx", dir);
+	if((th.idx_fd = open(path, O_RDWR | O_CREAT, 0600)) == -1)
+		return -1;
+	snprintf(path, sizeof(path), "%s/thumbs.dat", dir);
+	if((th.dat_fd = open(path, O_RDWR | O_CREAT, 0600)) == -1)
+		return -1;
+
+	flock(th.idx_fd, LOCK_EX);
+	if(ftruncate(th.idx_fd, THUMB_INDEX_BYTES) ||
+	   (map = mmap(NULL, THUMB_INDEX_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, th.idx_fd, 0)) == MAP_FAILED)
+	{
+		flock(th.idx_fd, LOCK_UN);
+		return -1;
+	}
+	th.index = (struct thumb_index*)map;
+	th.entries = (struct thumb_entry*)(th.index + 1);
+	if(memcmp(th.index->magic, thumb_magic, sizeof(thumb_magic)) ||
+	   th.index->size != THUMB_SIZE || th.index->buckets != THUMB_BUCKETS)
+		cache_reset();
+	flock(th.idx_fd, LOCK_UN);
+	return 0;
+}
+
+static void cache_close(void)
+{
+	if(th.index)
+		munmap(th.index, THUMB_INDEX_BYTES);
+	if(th.idx_fd != -1)
+		close(th.idx_fd);
+	if(th.dat_fd != -1)
+		close(th.dat_fd);
+	th.index = NULL;
+	th.idx_fd = th.dat_fd = -1;
+}
+
+/* the bucket of key, or the empty one it would go in */
+static struct thumb_entry *cache_find(u_int64_t key)
+{
+	unsigned int i = key % THUMB_BUCKETS;
+
+	while(th.entries[i].key && th.entries[i].key != key)
+		i = (i + 1) % THUMB_BUCKETS;
+	return &th.entries[i];
+}
+
+/* other fbv processes share the files: flock() on top of the mutex */
+static int cache_get(u_int64_t key, const struct stat *st, struct thumb *t)
+{
+	struct thumb_entry *e;
+	size_t n;
+	int ret = -1;
+
+	pthread_mutex_lock(&th.cache_lock);
+	flock(th.idx_fd, LOCK_SH);
+	e = cache_find(key);
+	if(e->key && e->mtime == st->st_mtime && e->bytes == st->st_size)
+	{
+		t->width = e->width;
+		t->height = e->height;
+		n = (size_t)t->width * t->height * 3;
+		if((t->rgb = (unsigned char*)malloc(n)) &&
+		   pread(th.dat_fd, t->rgb, n, e->offset) == (ssize_t)n)
+			ret = 0;
+		else
+		{
+			free(t->rgb);
+			t->rgb = NULL;
+		}
+	}
+	flock(th.idx_fd, LOCK_UN);
+	pthread_mutex_unlock(&th.cache_lock);
+	return ret;
+}
+
+static void cache_put(u_int64_t key, const struct stat *st, const struct thumb *t)
+{
+	size_t n = (size_t)t->width * t->height * 3;
+	struct thumb_entry *e;
+
+	pthread_mutex_lock(&th.cache_lock);
+	flock(th.idx_fd, LOCK_EX);
+	if(th.index->used >= THUMB_BUCKETS / 4 * 3 || th.index->end + n > THUMB_DATA_MAX)
+		cache_reset();
+	e = cache_find(key);
+	if(pwrite(th.dat_fd, t->rgb, n, th.index->end) == (ssize_t)n)
+	{
+		if(!e->key)
+			th.index->used++;
+		e->mtime = st->st_mtime;
+		e->bytes = st->st_size;
+		e->offset = th.index->end;
+		e->width = t->width;
+		e->height = t->height;
+		e->key = key;
+		th.index->end += n;
+	}
+	flock(th.idx_fd, LOCK_UN);
+	pthread_mutex_unlock(&th.cache_lock);
+}
+
+/* from the cache, else made and cached */
+static int thumb_load(char *filename, struct thumb *t)
+{
+	char *path;
+	struct stat st;
+	u_int64_t key = 0;
+
+	if(th.index && !stat(filename, &st) && (path = realpath(filename, NULL)))
+	{
+		key = thumb_key(path);
+		free(path);
+		if(!cache_get(key, &st, t))
+			return 0;
+	}
+	if(th.make(filename, THUMB_SIZE, t))
+		return -1;
+	if(key)
+		cache_put(key, &st, t);
+	return 0;
+}
+
+/* the next file without a thumbnail: on the page asked for, then the next one */
+static int next_job(void)
+{
+	int i;
+
+	for(i = th.first; i < th.first + 2 * th.want && i < th.count; i++)
+		if(th.slots[i].state == THUMB_NONE)
+			return i;
+	return -1;
+}
+
+static void *worker(void *arg)
+{
+	struct thumb t;
+	int index, ret;
+
+	pthread_mutex_lock(&th.lock);
+	while(!th.quit)
+	{
+		if((index = next_job()) < 0)
+		{
+			pthread_cond_wait(&th.work, &th.lock);
+			continue;
+		}
+		th.slots[index].state = THUMB_BUSY;
+		pthread_mutex_unlock(&th.lock);
+
+		memset(&t, 0, sizeof(t));
+		ret = thumb_load(th.files[index], &t);
+
+		pthread_mutex_lock(&th.lock);
+		th.slots[index].t = t;
+		th.slots[index].state = ret ? THUMB_FAILED : THUMB_DONE;
+		write(th.pipe[1], "", 1);
+	}
+	pthread_mutex_unlock(&th.lock);
+	return NULL;
+}
+
+int thumbs_start(char **files, int count, thumb_make_fn make)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, n = cpus < 1 ? 1 : cpus > THUMB_WORKERS ? THUMB_WORKERS : cpus;
+
+	th.files = files;
+	th.count = count;
+	th.make = make;
+	th.idx_fd = th.dat_fd = -1;
+	pthread_mutex_init(&th.cache_lock, NULL);
+	if(cache_open())
+		cache_close();
+
+	if(!(th.slots = (struct thumb_slot*)calloc(count, sizeof(*th.slots))) || pipe(th.pipe))
+	{
+		free(th.slots);
+		th.slots = NULL;
+		cache_close();
+		return -1;
+	}
+	fcntl(th.pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(th.pipe[1], F_SETFL, O_NONBLOCK);
+
+	for(i = 0; i < n; i++)
+		if(pthread_create(&th.threads[i], NULL, worker, NULL))
+			break;
+	th.nthreads = i;
+	return i ? 0 : -1;
+}
+
+/*
+ * Make the count thumbnails from first the next ones, and forget those
+ * more than a page of them away; the pixels of the others stay valid
+ * until the next call.
+ */
+void thumbs_want(int first, int count)
+{
+	int i;
+	char buf[64];
+
+	pthread_mutex_lock(&th.lock);
+	th.first = first;
+	th.want = count;
+	for(i = 0; i < th.count; i++)
+		if(th.slots[i].state == THUMB_DONE && (i < first - count || i >= first + 2 * count))
+		{
+			free(th.slots[i].t.rgb);
+			memset(&th.slots[i], 0, sizeof(th.slots[i]));
+		}
+	while(read(th.pipe[0], buf, sizeof(buf)) > 0)
+		;
+	pthread_cond_broadcast(&th.work);
+	pthread_mutex_unlock(&th.lock);
+}
+
+/* 1 and the thumbnail of files[index] if it is done, 0 if not yet, -1 if it cannot be made */
+int thumbs_get(int index, struct thumb *t)
+{
+	int state;
+
+	pthread_mutex_lock(&th.lock);
+	state = th.slots[index].state;
+	*t = th.slots[index].t;
+	pthread_mutex_unlock(&th.lock);
+	return state == THUMB_DONE ? 1 : state == THUMB_FAILED ? -1 : 0;
+}
+
+int thumbs_fd(void)
+{
+	return th.pipe[0];
+}
+
+void thumbs_stop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&th.lock);
+	th.quit = 1;
+	pthread_cond_broadcast(&th.work);
+	pthread_mutex_unlock(&th.lock);
+
+	for(i = 0; i < th.nthreads; i++)
+		pthread_join(th.threads[i], NULL);
+	th.nthreads = 0;
+	for(i = 0; th.slots && i < th.count; i++)
+		free(th.slots[i].t.rgb);
+	free(th.slots);
+	th.slots = NULL;
+	close(th.pipe[0]);
+	close(th.pipe[1]);
+	cache_close();
+}
@@ -0,0 +1,393 @@
+/*
+ * tiles.c
+ *
+ * Pictures bigger than memory. The file is decoded once, a row at a
+ * time: every row is copied into its tiles, written through a mapping of
+ * one row of tiles of an unlinked temporary file ($TMPDIR, else
+ * /var/tmp), and averaged into an overview at most OVERVIEW_MAX pixels
+ * on a side that is kept in memory like an ordinary decoded picture.
+ * Every pair of rows is also halved into the next level of a pyramid of
+ * tiles in the same file, down to about the size of the overview.
+ * Views coarser than the overview are sampled from it; finer ones from
+ * a region of the nearest level at least as big, and the full size view
+ * maps the tiles it shows, a fixed number of them at a time. Where only
+ * an overview is wanted (a thumbnail) it is made the same way, with no
+ * tiles.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fbv.h"
+
+#define OVERVIEW_MAX	2048
+#define TILE_SLOTS	128	/* tiles mapped at once: 32 MB with alpha */
+
+/* the state of one tiles_load() or tiles_overview() */
+struct tile_writer
+{
+	struct tiles *t;	/* NULL for an overview alone */
+	int width, height;
+	int want_alpha, alpha;
+	unsigned char *strip[TILE_LEVELS];	/* the row of tiles being written per level, mapped */
+	unsigned char *even[TILE_LEVELS];	/* the last even row per level, rgb then alpha */
+	unsigned char *half[TILE_LEVELS];	/* the row of the next level made with it */
+	int shift;		/* overview pixels are 1 << shift squares */
+	int ov_width;
+	unsigned int *sum;	/* r, g, b, a of the overview row being built */
+	unsigned char *ov_rgb, *ov_alpha;
+};
+
+static int tiles_create(struct tiles *t, int alpha)
+{
+	const char *dir = getenv("TMPDIR");
+	char path[4096];
+	size_t page = sysconf(_SC_PAGESIZE), count = 0;
+	int n;
+
+	t->alpha = alpha;
+	t->block = (size_t)TILE_SIZE * TILE_SIZE * (alpha ? 4 : 3);
+	t->block = (t->block + page - 1) / page * page;
+	for(n = 0; n < t->nlevels; n++)
+	{
+		t->level[n].first = count;
+		count += (size_t)t->level[n].columns * t->level[n].rows;
+	}
+
+	snprintf(path, sizeof(path), "%s/fbv-XXXXXX", dir && *dir ? dir : "/var/tmp");
+	if((t->fd = mkstemp(path)) == -1)
+		return -1;
+	unlink(path);
+	/* reserved up front: a full disk met through the mapping is SIGBUS */
+	return posix_fallocate(t->fd, 0, (off_t)t->block * count) ? -1 : 0;
+}
+
+/* the overview row made of the rows summed since the last one */
+static void overview_row(struct tile_writer *w, int y)
+{
+	int oy = y >> w->shift, ys = oy << w->shift, rows = y + 1 - ys;
+	unsigned char *rgb = w->ov_rgb + (size_t)oy * w->ov_width * 3;
+	unsigned int *s = w->sum;
+	int x, c;
+
+	for(x = 0; x < w->ov_width; x++, s += 4)
+	{
+		int cols = min(1 << w->shift, w->width - (x << w->shift));
+		unsigned int n = rows * cols;
+
+		for(c = 0; c < 3; c++)
+			*rgb++ = (s[c] + n / 2) / n;
+		if(w->ov_alpha)
+			w->ov_alpha[(size_t)oy * w->ov_width + x] = (s[3] + n / 2) / n;
+	}
+	memset(w->sum, 0, w->ov_width * 4 * sizeof(*w->sum));
+}
+
+/* row y of level n copied into its tiles */
+static int put_tiles(struct tile_writer *w, int n, int y, const unsigned char *rgb, const unsigned char *alpha)
+{
+	struct tiles *t = w->t;
+	struct tile_level *l = &t->level[n];
+	int r = y % TILE_SIZE, c;
+	size_t span = t->block * l->columns;
+
+	if(!r)
+	{
+		w->strip[n] = (unsigned char*)mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd,
+			(off_t)t->block * l->first + (off_t)span * (y / TILE_SIZE));
+		if(w->strip[n] == MAP_FAILED)
+		{
+			w->strip[n] = NULL;
+			return -1;
+		}
+	}
+
+	for(c = 0; c < l->columns; c++)
+	{
+		unsigned char *tile = w->strip[n] + t->block * c;
+		int len = min(TILE_SIZE, l->width - c * TILE_SIZE);
+
+		memcpy(tile + r * TILE_SIZE * 3, rgb + c * TILE_SIZE * 3, len * 3);
+		if(alpha)
+			memcpy(tile + TILE_SIZE * TILE_SIZE * 3 + r * TILE_SIZE, alpha + c * TILE_SIZE, len);
+	}
+	if(r == TILE_SIZE - 1 || y == l->height - 1)
+	{
+		munmap(w->strip[n], span);
+		w->strip[n] = NULL;
+	}
+	return 0;
+}
+
+/*
+ * Row y of level n into its tiles, and every second row halved with
+ * the one before into the next level, as halve() would: each pixel the
+ * rounded average of a 2 x 2 block, an odd last row or column dropped.
+ */
+static int put_level(struct tile_writer *w, int n, int y, const unsigned char *rgb, const unsigned char *alpha)
+{
+	struct tiles *t = w->t;
+	int width = t->level[n].width, x, c;
+	const unsigned char *a, *b;
+	unsigned char *d;
+
+	if(put_tiles(w, n, y, rgb, alpha))
+		return -1;
+	if(n + 1 >= t->nlevels)
+		return 0;
+	if(!(y & 1))
+	{
+		memcpy(w->even[n], rgb, width * 3);
+		if(alpha)
+			memcpy(w->even[n] + width * 3, alpha, width);
+		return 0;
+	}
+
+	width = t->level[n + 1].width;
+	for(x = 0, a = w->even[n], b = rgb, d = w->half[n]; x < width; x++, a += 6, b += 6)
+		for(c = 0; c < 3; c++)
+			*d++ = (a[c] + a[c + 3] + b[c] + b[c + 3] + 2) >> 2;
+	if(alpha)
+		for(x = 0, a = w->even[n] + t->level[n].width * 3, b = alpha; x < width; x++, a += 2, b += 2)
+			*d++ = (a[0] + a[1] + b[0] + b[1] + 2) >> 2;
+	return put_level(w, n + 1, y / 2, w->half[n], alpha ? w->half[n] + width * 3 : NULL);
+}
+
+static int put_row(void *ctx, int y, const unsigned char *rgb, const unsigned char *alpha)
+{
+	struct tile_writer *w = (struct tile_writer*)ctx;
+	unsigned int *s;
+	int x;
+
+	if(!y)
+	{
+		w->alpha = w->want_alpha && alpha;
+		if(w->t && tiles_create(w->t, w->alpha))
+			return -1;
+		if(w->alpha && !(w->ov_alpha = (unsigned char*)malloc((size_t)w->ov_width * (((w->height - 1) >> w->shift) + 1))))
+			return -1;
+	}
+	if(!w->alpha)
+		alpha = NULL;
+	if(w->t && put_level(w, 0, y, rgb, alpha))
+		return -1;
+
+	for(x = 0; x < w->width; x++, rgb += 3)
+	{
+		s = w->sum + (x >> w->shift) * 4;
+		s[0] += rgb[0];
+		s[1] += rgb[1];
+		s[2] += rgb[2];
+		if(alpha)
+			s[3] += alpha[x];
+	}
+
+	if(((y + 1) & ((1 << w->shift) - 1)) == 0 || y == w->height - 1)
+		overview_row(w, y);
+	return 0;
+}
+
+/*
+ * The p->width x p->height picture in fh decoded a row at a time into
+ * w's overview, at most max pixels on a side; p's rgb, alpha and size
+ * become those of the overview.
+ */
+static int load_overview(struct tile_writer *w, struct picture *p, const struct fh_loader *l, FILE *fh, int max)
+{
+	int width = p->width, height = p->height, ret;
+
+	w->width = width;
+	w->height = height;
+	while((width - 1) >> w->shift >= max || (height - 1) >> w->shift >= max)
+		w->shift++;
+	w->ov_width = ((width - 1) >> w->shift) + 1;
+
+	w->sum = (unsigned int*)calloc(w->ov_width * 4, sizeof(*w->sum));
+	w->ov_rgb = (unsigned char*)malloc((size_t)w->ov_width * (((height - 1) >> w->shift) + 1) * 3);
+	if(!w->sum || !w->ov_rgb)
+		ret = FH_ERROR_FILE;
+	else
+		ret = l->load_rows(fh, width, height, put_row, w);
+
+	free(w->sum);
+	if(ret != FH_ERROR_OK)
+	{
+		free(w->ov_rgb);
+		free(w->ov_alpha);
+		return ret;
+	}
+	p->rgb = w->ov_rgb;
+	p->alpha = w->ov_alpha;
+	p->width = w->ov_width;
+	p->height = ((height - 1) >> w->shift) + 1;
+	return FH_ERROR_OK;
+}
+
+/*
+ * Only an overview of the p->width x p->height picture in fh, at most
+ * max pixels on a side and with alpha if asked for and there is some,
+ * into p's rgb, alpha and size.
+ */
+int tiles_overview(struct picture *p, const struct fh_loader *l, FILE *fh, int max, int alpha)
+{
+	struct tile_writer w;
+
+	if(!l->load_rows)
+		return FH_ERROR_FORMAT;
+	memset(&w, 0, sizeof(w));
+	w.want_alpha = alpha;
+	return load_overview(&w, p, l, fh, max);
+}
+
+/*
+ * Decode the p->width x p->height picture in fh as tiles, into p->tiles;
+ * p's rgb, alpha and size become those of the overview.
+ */
+int tiles_load(struct picture *p, const struct fh_loader *l, FILE *fh, int alpha)
+{
+	struct tile_writer w;
+	struct tiles *t;
+	int i, n, ret = FH_ERROR_OK;
+
+	if(!l->load_rows)
+		return FH_ERROR_FORMAT;
+
+	memset(&w, 0, sizeof(w));
+	if(!(t = (struct tiles*)calloc(1, sizeof(*t))))
+		return FH_ERROR_FILE;
+	t->fd = -1;
+	t->width = p->width;
+	t->height = p->height;
+	t->nslots = TILE_SLOTS;
+	w.t = t;
+	w.want_alpha = alpha;
+
+	/* halved while still bigger than the overview will be */
+	for(n = 0; n < TILE_LEVELS; n++)
+	{
+		struct tile_level *tl = &t->level[n];
+
+		tl->width = n ? t->level[n - 1].width / 2 : t->width;
+		tl->height = n ? t->level[n - 1].height / 2 : t->height;
+		tl->columns = (tl->width + TILE_SIZE - 1) / TILE_SIZE;
+		tl->rows = (tl->height + TILE_SIZE - 1) / TILE_SIZE;
+		t->nlevels = n + 1;
+		if(tl->width / 2 < OVERVIEW_MAX && tl->height / 2 < OVERVIEW_MAX)
+			break;
+	}
+	for(n = 0; n + 1 < t->nlevels; n++)
+		if(!(w.even[n] = (unsigned char*)malloc((size_t)t->level[n].width * 4)) ||
+		   !(w.half[n] = (unsigned char*)malloc((size_t)t->level[n + 1].width * 4)))
+			ret = FH_ERROR_FILE;
+
+	if(ret != FH_ERROR_OK || !(t->slots = (struct tile_slot*)calloc(t->nslots, sizeof(*t->slots))))
+		ret = FH_ERROR_FILE;
+	else
+		ret = load_overview(&w, p, l, fh, OVERVIEW_MAX);
+
+	for(n = 0; n < t->nlevels; n++)
+	{
+		if(w.strip[n])
+			munmap(w.strip[n], t->block * t->level[n].columns);
+		free(w.even[n]);
+		free(w.half[n]);
+	}
+	if(ret != FH_ERROR_OK)
+	{
+		tiles_free(t);
+		return ret;
+	}
+	for(i = 0; i < t->nslots; i++)
+		t->slots[i].index = -1;
+	p->tiles = t;
+	return FH_ERROR_OK;
+}
+
+/* tile column, row of level n mapped, evicting the least recently used one; NULL if it cannot be */
+const unsigned char *tiles_get(struct tiles *t, int n, int column, int row)
+{
+	int index = t->level[n].first + row * t->level[n].columns + column;
+	struct tile_slot *s = t->slots;
+	int i;
+
+	for(i = 0; i < t->nslots; i++)
+	{
+		if(t->slots[i].index == index)
+		{
+			s = &t->slots[i];
+			s->used = ++t->clock;
+			return s->map;
+		}
+		if(t->slots[i].used < s->used)
+			s = &t->slots[i];
+	}
+
+	if(s->map)
+		munmap(s->map, t->block);
+	s->index = -1;
+	s->map = (unsigned char*)mmap(NULL, t->block, PROT_READ, MAP_SHARED, t->fd, (off_t)t->block * index);
+	if(s->map == MAP_FAILED)
+	{
+		s->map = NULL;
+		return NULL;
+	}
+	s->index = index;
+	s->used = ++t->clock;
+	return s->map;
+}
+
+/*
+ * The width x height pixels at x, y of level n copied out of its tiles
+ * into rgb, and alpha unless it is NULL, rows packed. Returns -1 when a
+ * tile cannot be mapped.
+ */
+int tiles_read(struct tiles *t, int n, int x, int y, int width, int height, unsigned char *rgb, unsigned char *alpha)
+{
+	int tx, ty, x0, y0, w, h, i, cx, cy;
+	const unsigned char *tile;
+
+	for(cy = 0; cy < height; cy += h)
+	{
+		ty = (y + cy) / TILE_SIZE;
+		y0 = (y + cy) % TILE_SIZE;
+		h = min(TILE_SIZE - y0, height - cy);
+		for(cx = 0; cx < width; cx += w)
+		{
+			tx = (x + cx) / TILE_SIZE;
+			x0 = (x + cx) % TILE_SIZE;
+			w = min(TILE_SIZE - x0, width - cx);
+			if(!(tile = tiles_get(t, n, tx, ty)))
+				return -1;
+			for(i = 0; i < h; i++)
+			{
+				memcpy(rgb + ((size_t)(cy + i) * width + cx) * 3, tile + ((y0 + i) * TILE_SIZE + x0) * 3, w * 3);
+				if(alpha)
+					memcpy(alpha + (size_t)(cy + i) * width + cx,
+						tile + TILE_SIZE * TILE_SIZE * 3 + (y0 + i) * TILE_SIZE + x0, w);
+			}
+		}
+	}
+	return 0;
+}
+
+void tiles_free(struct tiles *t)
+{
+	int i;
+
+	if(!t)
+		return;
+	for(i = 0; t->slots && i < t->nslots; i++)
+		if(t->slots[i].map)
+			munmap(t->slots[i].map, t->block);
+	if(t->fd != -1)
+		close(t->fd);
+	free(t->slots);
+	free(t);
+}
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include "fbv.h"
 
 unsigned char * simple_resize(unsigned char * orgin,
                               int ox, int oy, int dx, int dy)
@@ -40,55 +41,62 @@ unsigned char * alpha_resize(unsigned char * alpha, int ox, int oy, int dx, int
 	return cr;
 }
 
-unsigned char * color_average_resize(unsigned char * orgin, int ox, int oy, int dx, int dy)
+#define ROTATE_TILE	32
+
+/*
+ * 90 degree turns as a tiled transpose: a ROTATE_TILE square of source
+ * pixels is written to ROTATE_TILE destination rows that stay cached,
+ * instead of every pixel landing on a new destination row. Pixels are
+ * bpp bytes, source rows stride bytes apart; rot 1 turns right, 3 turns
+ * left. The resampler turns blocks of bigger images with it too.
+ */
+void rotate_tiled(unsigned char *n, const unsigned char *i, size_t stride, int ox, int oy, int rot, int bpp)
 {
-	unsigned char *cr,*p,*q;
-	int i,j,k,l,xa,xb,ya,yb;
-	int sq,r,g,b;
-	assert(cr=(unsigned char*) malloc(dx*dy*3)); p=cr;
-	
-	for(j=0;j<dy;j++)
+	long step = rot == 1 ? (long)oy * bpp : -(long)oy * bpp;
+	int tx, ty, x, y, xe, ye;
+
+	for(ty = 0; ty < oy; ty += ROTATE_TILE)
 	{
-		for(i=0;i<dx;i++,p+=3)
+		ye = ty + ROTATE_TILE < oy ? ty + ROTATE_TILE : oy;
+		for(tx = 0; tx < ox; tx += ROTATE_TILE)
 		{
-			xa=i*ox/dx;
-			ya=j*oy/dy;
-			xb=(i+1)*ox/dx; if(xb>=ox) xb=ox-1;
-			yb=(j+1)*oy/dy; if(yb>=oy) yb=oy-1;
-			for(l=ya,r=0,g=0,b=0,sq=0;l<=yb;l++)
+			xe = tx + ROTATE_TILE < ox ? tx + ROTATE_TILE : ox;
+			for(y = ty; y < ye; y++)
 			{
-				q=orgin+((l*ox+xa)*3);
-				for(k=xa;k<=xb;k++,q+=3,sq++)
-				{
-					r+=q[0]; g+=q[1]; b+=q[2];
-				}
+				const unsigned char *s = i + (size_t)y * stride + (size_t)tx * bpp;
+				unsigned char *d;
+
+				if(rot == 1)
+					d = n + ((size_t)tx * oy + (oy - 1 - y)) * bpp;
+				else
+					d = n + ((size_t)(ox - 1 - tx) * oy + y) * bpp;
+
+				if(bpp == 3)
+					for(x = tx; x < xe; x++, s += 3, d += step)
+					{
+						d[0] = s[0];
+						d[1] = s[1];
+						d[2] = s[2];
+					}
+				else
+					for(x = tx; x < xe; x++, s++, d += step)
+						*d = *s;
 			}
-			p[0]=r/sq; p[1]=g/sq; p[2]=b/sq;
 		}
 	}
-	return cr;
 }
 
 unsigned char * rotate(unsigned char *i, int ox, int oy, int rot)
 {
 	unsigned char * n, * p;
-	int x, y;
+	int y;
 	assert(n = (unsigned char*) malloc(ox * oy * 3));
 	
 	switch(rot)
 	{
 		case 1: /* 90 deg right */
-			p = n + (oy - 1) * 3;
-			for(y = 0; y<oy; y++, p -= 3)
-			{
-				unsigned char * r = p;
-				for(x = 0; x<ox; x++, r += oy * 3)
-				{
-					r[0] = *(i++);
-					r[1] = *(i++);
-					r[2] = *(i++);
-				}
-			}
+		case 3: /* 90 deg left */
+			rotate_tiled(n, i, (size_t)ox * 3, ox, oy, rot, 3);
 			break;
 		case 2: /* 180 deg */
 			i += ox * oy * 3; p = n;
@@ -101,20 +109,6 @@ unsigned char * rotate(unsigned char *i, int ox, int oy, int rot)
 				p += 3;
 			}
 			break;
-		case 3: /* 90 deg left */
-			p = n;
-			for(y = 0; y<oy; y++, p += 3)
-			{
-				unsigned char * r = p + ((ox * 3) * oy);
-				for(x = 0; x<ox; x++)
-				{
-					r -= oy * 3;
-					r[0] = *(i++);
-					r[1] = *(i++);
-					r[2] = *(i++);
-				}
-			}
-			break;
 	}
 	return n;
 }
@@ -122,38 +116,20 @@ unsigned char * rotate(unsigned char *i, int ox, int oy, int rot)
 unsigned char * alpha_rotate(unsigned char *i, int ox, int oy, int rot)
 {
 	unsigned char * n, * p;
-	int x, y;
+	int y;
 	assert(n = (unsigned char*) malloc(ox * oy));
 	
 	switch(rot)
 	{
 		case 1: /* 90 deg right */
-			p = n + (oy - 1);
-			for(y = 0; y<oy; y++, p --)
-			{
-				unsigned char * r = p;
-				for(x = 0; x<ox; x++, r += oy)
-					*r = *(i++);
-			}
+		case 3: /* 90 deg left */
+			rotate_tiled(n, i, ox, ox, oy, rot, 1);
 			break;
 		case 2: /* 180 deg */
 			i += ox * oy; p = n;
 			for(y = ox * oy; y > 0; y--)
-				*(p++) = *(i--);
-			break;
-		case 3: /* 90 deg left */
-			p = n;
-			for(y = 0; y<oy; y++, p++)
-			{
-				unsigned char * r = p + (ox * oy);
-				for(x = 0; x<ox; x++)
-				{
-					r -= oy;
-					*r = *(i++);
-				}
-			}
+				*(p++) = *(--i);
 			break;
 	}
 	return n;
 }
-
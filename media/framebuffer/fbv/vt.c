@@ -11,6 +11,7 @@
 #include <signal.h>
 #include <sys/ioctl.h>
 #include <linux/vt.h>
+#include "fbv.h"
 
 /*
  * signal handler: leave the virtual terminal
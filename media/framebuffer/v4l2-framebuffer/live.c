@@ -8,20 +8,24 @@
  ============================================================================
  */
 
-#include "draw_framebuffer.h"
 #include "video_capture.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "fbv.h"
+
 /* check the supported webcam resolutions using $v4l2-ctl --list-formats-ext */
 
 int main(int argc, char** argv) {
 	int width = 0, height = 0;
+	const char* device = NULL;
+	struct fb_context fb;
 
-	if (argc >= 1) width = atoi(argv[0]);
-	if (argc >= 2) height = atoi(argv[1]);
+	if (argc >= 2) width = atoi(argv[1]);
+	if (argc >= 3) height = atoi(argv[2]);
+	if (argc >= 4) device = argv[3];
 
 	if (width == 0) width = 640;
 	if (height == 0) height = 480;
@@ -30,18 +34,19 @@ int main(int argc, char** argv) {
 	usleep(1 * 1000000); // sleep one second
 
     unsigned char src_image[width * height * 3];
-    init_framebuffer();
-	init_video_capture(width, height);
+	if (fb_open(&fb, NULL))
+		return EXIT_FAILURE;
+	init_video_capture(device, width, height);
 	char key = 0;
 
 	for(; ;){
 		key = video_capture(src_image, width, height);
-		draw_framebuffer(src_image, width, height);
+		fb_draw_rgb(&fb, src_image, width * 3, width, height, 0, 0);
 		if(key == 'q'){
 			break;
 		}
 	}
     free_video_capture();
-	free_framebuffer();
+	fb_close(&fb);
 	return EXIT_SUCCESS;
 }
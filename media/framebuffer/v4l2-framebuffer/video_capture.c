@@ -20,7 +20,7 @@
 #include <limits.h>             /* for UCHAR_MAX */
 
 
-static char* dev_name = "/dev/video0";
+static const char* dev_name = "/dev/video0";
 static int fd = -1; /* vidoe0 file descriptor*/
 
 /* Queried image buffers! */
@@ -219,22 +219,19 @@ static void parse_im(const unsigned char *im_yuv, unsigned char *dst, int width,
         B = Y + 1.773 * (U - 128);
         G = Y - 0.344 * (U - 128) - (0.714 * (V - 128));
         R = Y + 1.403 * (V - 128);
-        if(B > UCHAR_MAX){
-            B = UCHAR_MAX;
-        }
-        if(G > UCHAR_MAX){
-            G = UCHAR_MAX;
-        }
-        if(R > UCHAR_MAX){
-            R = UCHAR_MAX;
-        }
-        dst[3*i] = B;
+        B = B < 0 ? 0 : B > UCHAR_MAX ? UCHAR_MAX : B;
+        G = G < 0 ? 0 : G > UCHAR_MAX ? UCHAR_MAX : G;
+        R = R < 0 ? 0 : R > UCHAR_MAX ? UCHAR_MAX : R;
+        /* RGB888, as the framebuffer library takes it */
+        dst[3*i] = R;
         dst[3*i+1] = G;
-        dst[3*i+2] = R;
+        dst[3*i+2] = B;
     }
 }
 
-void init_video_capture(int width, int height){
+void init_video_capture(const char* device, int width, int height){
+	if(device)
+		dev_name = device;
 	open_device();
 	init_device(width, height);
 	start_capturing();
@@ -17,7 +17,7 @@ struct buffer {
 	size_t length;
 };
 
-void init_video_capture(int width, int height);
+void init_video_capture(const char* device, int width, int height);
 char video_capture(unsigned char* dst, int width, int height);
 void free_video_capture();
 